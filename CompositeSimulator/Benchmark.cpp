@@ -0,0 +1,483 @@
+//host benchmarks and checks of the encoder and the graphics, the numbers quoted in the commit messages come from here.
+//timings are host nanoseconds, they only compare the variants with each other.
+//build: g++ -O2 -Iesp32 Benchmark.cpp -o Benchmark
+//usage: Benchmark [name], without a name all of them run
+
+#include <stdio.h>
+#include <malloc.h>
+#include "Arduino.h"
+#include "../CompositeVideoSimple/CompositeGraphics.h"
+#include "../CompositeVideoSimple/CompositeOutput.h"
+#include "../CompositeVideoSimple/Image.h"
+#include "../CompositeVideoSimple/font6x8.h"
+
+double nanos()
+{
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//keeps the compiler from dropping the work that is timed
+volatile unsigned int sink;
+
+//the encoder before the pixel word table: two swizzled 16 bit stores per pixel
+void fillLineSamples(char levelBlack, const char *pixels, unsigned short *active, int samples)
+{
+  int i = 0;
+  for(int x = 0; x < samples / 2; x++)
+  {
+    short pix = (levelBlack + pixels[x]) << 8;
+    active[i++^1] = pix;
+    active[i++^1] = pix;
+  }
+}
+
+void encoder()
+{
+  printf("encoder: per sample stores vs pixel word table, ns per line\n");
+  const int widths[] = {640, 648};
+  for(int w = 0; w < 2; w++)
+  {
+    CompositeOutput composite(CompositeOutput::NTSC, widths[w], 400);
+    int samples = composite.targetXres;
+    char pixels[400];
+    for(int i = 0; i < samples / 2; i++)
+      pixels[i] = i % 55;
+    unsigned short *a = (unsigned short*)malloc(samples * 2);
+    unsigned short *b = (unsigned short*)malloc(samples * 2);
+    const int n = 200000;
+    double t0 = nanos();
+    for(int i = 0; i < n; i++)
+    {
+      pixels[i & 255] = i % 55;
+      fillLineSamples(composite.levelBlack, pixels, a, samples);
+      sink += a[i & 255];
+    }
+    double t1 = nanos();
+    for(int i = 0; i < n; i++)
+    {
+      pixels[i & 255] = i % 55;
+      composite.fillLine(pixels, b);
+      sink += b[i & 255];
+    }
+    double t2 = nanos();
+    printf("  %d samples: %.0f vs %.0f, %s output\n", samples, (t1 - t0) / n, (t2 - t1) / n, memcmp(a, b, samples * 2) ? "different" : "same");
+    free(a);
+    free(b);
+  }
+}
+
+//random dots, lines, rects, blits and text, the same for the same seed
+unsigned char sceneImage[37 * 23];
+Font<CompositeGraphics> sceneFont(6, 8, font6x8::pixels);
+void scene(CompositeGraphics &g, unsigned int seed)
+{
+  srand(seed);
+  Image<CompositeGraphics> image(37, 23, sceneImage);
+  g.setFont(sceneFont);
+  for(int i = 0; i < 300; i++)
+  {
+    int kind = rand() % 5, x = rand() % 360 - 20, y = rand() % 240 - 20, color = rand() % 64;
+    if(kind == 0)
+      g.dot(x, y, color);
+    else if(kind == 1)
+      g.xLine(x, x + rand() % 100 - 50, y < 0 ? 0 : y % 200, color);
+    else if(kind == 2)
+      g.fillRect(x, y, rand() % 80, rand() % 40, color);
+    else if(kind == 3)
+      image.draw(g, x, y);
+    else
+    {
+      g.setCursor(x, y);
+      g.setTextColor(color, rand() % 2 ? -1 : 5);
+      g.print("Ab3");
+    }
+  }
+}
+
+void gray4()
+{
+  printf("gray4: 8 bit vs 4 bit pixels, us per frame\n");
+  for(int i = 0; i < (int)sizeof(sceneImage); i++)
+    sceneImage[i] = rand() % 64;
+  for(int full = 0; full < 2; full++)
+  {
+    int w = full ? 640 : 320, h = full ? 400 : 200;
+    CompositeOutput composite(CompositeOutput::NTSC, 640, 400);
+    composite.init();
+    composite.fullResolution = full;
+    CompositeGraphics g8(w, h), g4(w, h);
+    g4.setPixelFormat(PIXELS_GRAY4);
+    g8.init();
+    g4.init();
+    g8.begin(0);
+    g4.begin(0);
+    scene(g8, 7);
+    scene(g4, 7);
+    //the 4 bit frame has to match the quantized 8 bit one and encode to the same samples
+    int wrongPixels = 0, wrongLines = 0;
+    for(int y = 0; y < h; y++)
+      for(int x = 0; x < w; x++)
+      {
+        int n = CompositeGraphics::grayNibble(g8.get(x, y));
+        if(g4.get(x, y) != n * 4)
+          wrongPixels++;
+        g8.backbuffer[y][x] = composite.nibbleGrays[n];
+      }
+    static unsigned short a[700], b[700];
+    for(int y = 0; y < h; y++)
+    {
+      composite.frameFormat = PIXELS_GRAY8;
+      composite.encodeRow(g8.backbuffer[y], a);
+      composite.frameFormat = PIXELS_GRAY4;
+      composite.encodeRow(g4.backbuffer[y], b);
+      if(memcmp(a, b, composite.targetXres * 2))
+        wrongLines++;
+    }
+    const int n = 50;
+    double t0 = nanos();
+    for(int i = 0; i < n; i++)
+      scene(g8, i);
+    double t1 = nanos();
+    for(int i = 0; i < n; i++)
+      scene(g4, i);
+    double t2 = nanos();
+    composite.frameFormat = PIXELS_GRAY8;
+    for(int i = 0; i < n; i++)
+      for(int y = 0; y < h; y++)
+        composite.encodeRow(g8.backbuffer[y], a);
+    double t3 = nanos();
+    composite.frameFormat = PIXELS_GRAY4;
+    for(int i = 0; i < n; i++)
+      for(int y = 0; y < h; y++)
+        composite.encodeRow(g4.backbuffer[y], b);
+    double t4 = nanos();
+    sink += a[0] + b[0];
+    printf("  %dx%d: %d vs %d bytes, scene %.1f vs %.1f, scanout %.1f vs %.1f, %d wrong pixels, %d wrong lines\n",
+      w, h, w * h, g4.rowBytes * h, (t1 - t0) / n / 1000, (t2 - t1) / n / 1000, (t3 - t2) / n / 1000, (t4 - t3) / n / 1000, wrongPixels, wrongLines);
+  }
+}
+
+size_t heapUsed()
+{
+  struct mallinfo2 m = mallinfo2();
+  return m.uordblks + m.hblkhd;
+}
+
+void allocation()
+{
+  printf("allocation: a malloc per row vs one block per buffer, us per frame\n");
+  for(int full = 0; full < 2; full++)
+  {
+    int w = full ? 640 : 320, h = full ? 400 : 200;
+    size_t used = heapUsed();
+    char **rows[2];
+    for(int b = 0; b < 2; b++)
+    {
+      rows[b] = (char**)malloc(h * sizeof(char*));
+      for(int y = 0; y < h; y++)
+        rows[b][y] = (char*)malloc(w);
+    }
+    size_t rowBytes = heapUsed() - used;
+    used = heapUsed();
+    CompositeGraphics g(w, h);
+    g.init();
+    size_t blockBytes = heapUsed() - used;
+    //rows that follow their neighbour in memory
+    int gapsRows = 0, gapsBlock = 0;
+    for(int y = 1; y < h; y++)
+    {
+      gapsRows += rows[0][y] != rows[0][y - 1] + w;
+      gapsBlock += !g.contiguous(g.backbuffer, y - 1, y);
+    }
+    const int n = 200;
+    double t0 = nanos();
+    for(int i = 0; i < n; i++)
+      for(int y = 0; y < h; y++)
+        memset(rows[0][y], i, w);
+    double t1 = nanos();
+    for(int i = 0; i < n; i++)
+      memset(g.backbuffer[0], i, g.stride * h);
+    double t2 = nanos();
+    for(int i = 0; i < n; i++)
+      for(int y = 0; y < h; y++)
+        memcpy(rows[1][y], rows[0][y], w);
+    double t3 = nanos();
+    for(int i = 0; i < n; i++)
+      memcpy(g.frame[0], g.backbuffer[0], g.stride * h);
+    double t4 = nanos();
+    sink += rows[1][h - 1][0] + g.frame[h - 1][0];
+    printf("  %dx%d: %zu vs %zu heap bytes (the block includes the row tables and versions), %d vs %d row gaps\n",
+      w, h, rowBytes, blockBytes, gapsRows, gapsBlock);
+    printf("    clear %.1f vs %.1f, copy %.1f vs %.1f\n", (t1 - t0) / n / 1000, (t2 - t1) / n / 1000, (t3 - t2) / n / 1000, (t4 - t3) / n / 1000);
+    for(int b = 0; b < 2; b++)
+    {
+      for(int y = 0; y < h; y++)
+        free(rows[b][y]);
+      free(rows[b]);
+    }
+  }
+}
+
+void clear()
+{
+  printf("clear: clearing only changed rows with word fills\n");
+  PixelFormat formats[] = {PIXELS_GRAY8, PIXELS_GRAY4, PIXELS_MONO};
+  const char *names[] = {"gray8", "gray4", "mono"};
+  for(int f = 0; f < 3; f++)
+  {
+    //g clears lazily, r draws every pixel of the cleared area
+    CompositeGraphics g(320, 200), r(320, 200);
+    g.setPixelFormat(formats[f]);
+    r.setPixelFormat(formats[f]);
+    g.init();
+    r.init();
+    srand(1);
+    int wrongPixels = 0;
+    for(int i = 0; i < 400; i++)
+    {
+      int color = (i / 7) % 3 * 27;
+      int x = rand() % 300, y = rand() % 190, w = rand() % 100, h = rand() % 50;
+      int x0 = 0, y0 = 0, x1 = 320, y1 = 200;
+      if(rand() % 3 == 0)
+      {
+        //continues on the last frame and only clears the rectangle
+        g.begin(color, x, y, w, h);
+        x0 = x;
+        y0 = y;
+        x1 = x + w < 320 ? x + w : 320;
+        y1 = y + h < 200 ? y + h : 200;
+      }
+      else
+        g.begin(color);
+      r.begin();
+      for(int j = y0; j < y1; j++)
+        for(int k = x0; k < x1; k++)
+          r.dotFast(k, j, color);
+      for(int k = rand() % 20; k > 0; k--)
+      {
+        int ly = rand() % 200, lx = rand() % 320, lw = rand() % 50, lc = rand() % 55;
+        g.xLine(lx, lx + lw, ly, lc);
+        r.xLine(lx, lx + lw, ly, lc);
+      }
+      if(rand() % 4 == 0)
+      {
+        g.fillRect(0, y, 320, h, 40);
+        r.fillRect(0, y, 320, h, 40);
+      }
+      for(int j = 0; j < 200; j++)
+        for(int k = 0; k < 320; k++)
+          wrongPixels += g.get(k, j) != r.get(k, j);
+      g.end();
+      r.end();
+    }
+    printf("  %s: 400 frames, %d wrong pixels\n", names[f], wrongPixels);
+  }
+  CompositeGraphics g(320, 200);
+  g.init();
+  const int n = 2000;
+  double t0 = nanos();
+  for(int i = 0; i < n; i++)
+  {
+    g.begin();
+    //the clear before: an xLine per row
+    for(int y = 0; y < g.yres; y++)
+      g.xLine(0, g.xres, y, (i >> 1) & 1 ? 54 : 10);
+    g.end();
+  }
+  double t1 = nanos();
+  for(int i = 0; i < n; i++)
+  {
+    g.begin((i >> 1) & 1 ? 54 : 10);
+    g.end();
+  }
+  double t2 = nanos();
+  for(int i = 0; i < n; i++)
+  {
+    g.begin(54);
+    for(int y = 40; y < 100; y++)
+      g.xLine(100, 220, y, 5);
+    g.end();
+  }
+  double t3 = nanos();
+  printf("  320x200 gray8, us per frame: xLine per row %.1f, word fills %.1f, 60 drawn rows with their clear %.1f\n",
+    (t1 - t0) / n / 1000, (t2 - t1) / n / 1000, (t3 - t2) / n / 1000);
+}
+
+//pixel model of the damage check, the colors as the format stores them
+int modelPixels[200][320];
+PixelFormat modelFormat;
+void modelRect(int x, int y, int w, int h, int color)
+{
+  if(modelFormat == PIXELS_GRAY4)
+    color = CompositeGraphics::grayNibble(color) << 2;
+  else if(modelFormat == PIXELS_MONO)
+    color = color >= 28 ? 54 : 0;
+  for(int j = y; j < y + h; j++)
+    for(int i = x; i < x + w; i++)
+      if(i >= 0 && i < 320 && j >= 0 && j < 200)
+        modelPixels[j][i] = color;
+}
+
+void damage()
+{
+  printf("damage: restoring only the damaged spans of rows in begin()\n");
+  PixelFormat formats[] = {PIXELS_GRAY8, PIXELS_GRAY4, PIXELS_MONO, PIXELS_SAMPLES, PIXELS_SAMPLES};
+  const char *names[] = {"gray8", "gray4", "mono", "samples half", "samples full"};
+  static unsigned int words[256];
+  for(int c = 0; c < 256; c++)
+    words[c] = ((c + 20) & 255) * 0x01000100u;
+  for(int f = 0; f < 5; f++)
+  {
+    modelFormat = formats[f];
+    CompositeGraphics g(320, 200);
+    g.setPixelFormat(formats[f], words, f == 4);
+    g.init();
+    modelRect(0, 0, 320, 200, 0);
+    srand(7);
+    int wrongPixels = 0, differingRows = 0;
+    for(int i = 0; i < 3000; i++)
+    {
+      int mode = rand() % 10;
+      int color = rand() % 3 * 27;
+      int x = rand() % 330 - 5, y = rand() % 210 - 5, w = rand() % 60, h = rand() % 30;
+      if(mode == 0)
+      {
+        g.begin(color);
+        modelRect(0, 0, 320, 200, color);
+      }
+      else if(mode == 1)
+      {
+        g.begin(color, x, y, w, h);
+        modelRect(x, y, w, h, color);
+      }
+      else
+        g.begin();
+      for(int k = rand() % 6; k > 0; k--)
+      {
+        int op = rand() % 5, c = rand() % 55;
+        x = rand() % 330 - 5;
+        y = rand() % 200;
+        w = rand() % 40;
+        h = rand() % 10;
+        if(op == 0)
+        {
+          g.dot(x, y, c);
+          modelRect(x, y, 1, 1, c);
+        }
+        else if(op == 1)
+        {
+          g.xLine(x, x + w, y, c);
+          modelRect(x, y, w, 1, c);
+        }
+        else if(op == 2)
+        {
+          if(rand() & 1)
+          {
+            x = 0;
+            w = 320;
+          }
+          g.fillRect(x, y, w, h, c);
+          modelRect(x, y, w, h, c);
+        }
+        else if(op == 3)
+        {
+          unsigned char pixels[40];
+          for(int j = 0; j < w; j++)
+            pixels[j] = rand() % 55;
+          g.blitRow(x, y, pixels, w);
+          for(int j = 0; j < w; j++)
+            modelRect(x + j, y, 1, 1, pixels[j]);
+        }
+        else
+        {
+          unsigned int bits = rand() ^ (rand() << 16);
+          int back = rand() & 1 ? -1 : 10;
+          int count = rand() % 33;
+          g.maskRow(x, y, bits, count, c, back);
+          for(int j = 0; j < count && j < 32; j++)
+            if((bits >> j) & 1)
+              modelRect(x + j, y, 1, 1, c);
+            else if(back >= 0)
+              modelRect(x + j, y, 1, 1, back);
+        }
+      }
+      for(int j = 0; j < 200; j++)
+        for(int k = 0; k < 320; k++)
+          wrongPixels += g.get(k, j) != modelPixels[j][k];
+      g.end();
+      //rows with the same version in both buffers have to be the same
+      for(int j = 0; j < 200; j++)
+        if(CompositeGraphics::rowVersions(g.frame)[j] == CompositeGraphics::rowVersions(g.backbuffer)[j])
+          differingRows += memcmp(g.frame[j], g.backbuffer[j], g.rowBytes) != 0;
+    }
+    printf("  %s: 3000 frames, %d wrong pixels, %d rows with equal versions that differ\n", names[f], wrongPixels, differingRows);
+  }
+  //a counter on a static screen, begin() only has to bring the counter's span of the other buffer up to date
+  CompositeGraphics g(320, 200);
+  g.init();
+  static unsigned char glyphs[8 * 95];
+  for(int i = 0; i < 8 * 95; i++)
+    glyphs[i] = rand();
+  Font<CompositeGraphics> font(8, 8, glyphs);
+  g.setFont(font);
+  for(int i = 0; i < 2; i++)
+  {
+    g.begin(10);
+    g.fillRect(20, 20, 280, 160, 30);
+    g.end();
+  }
+  const int n = 20000;
+  double beginTime = 0, drawTime = 0;
+  for(int i = 0; i < n; i++)
+  {
+    double t0 = nanos();
+    g.begin();
+    double t1 = nanos();
+    g.setCursor(150, 100);
+    g.setTextColor(50, 30);
+    g.print(i, 10, 4);
+    drawTime += nanos() - t1;
+    beginTime += t1 - t0;
+    g.end();
+  }
+  int rows = 0, spanBytes = 0;
+  const CompositeGraphics::Damage *damaged = CompositeGraphics::rowDamage(g.frame);
+  for(int y = 0; y < 200; y++)
+    if(CompositeGraphics::rowVersions(g.frame)[y] == g.frameNumber)
+    {
+      int w0, w1;
+      g.spanWords(damaged[y].x0, damaged[y].x1, w0, w1);
+      rows++;
+      spanBytes += (w1 - w0) * 4;
+    }
+  printf("  counter on a static 320x200 screen: %d rows with %d span bytes to copy instead of %d row bytes, begin %.2f us, drawing %.2f us\n",
+    rows, spanBytes, rows * g.rowBytes, beginTime / n / 1000, drawTime / n / 1000);
+}
+
+int main(int argc, char **argv)
+{
+  struct { const char *name; void (*run)(); } benchmarks[] = {
+    {"encoder", encoder},
+    {"gray4", gray4},
+    {"allocation", allocation},
+    {"clear", clear},
+    {"damage", damage},
+  };
+  int count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+  bool found = false;
+  for(int i = 0; i < count; i++)
+    if(argc < 2 || !strcmp(argv[1], benchmarks[i].name))
+    {
+      benchmarks[i].run();
+      found = true;
+    }
+  if(!found)
+  {
+    printf("usage: Benchmark [name], the names are");
+    for(int i = 0; i < count; i++)
+      printf(" %s", benchmarks[i].name);
+    printf("\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,921 @@
+//code by bitluni (send me a high five if you like the code)
+//runs CompositeOutput on the host: the sample stream of the CompositeVideoSimple scene is captured,
+//decoded like a TV would by finding the syncs and written as PGM.
+//build: g++ -O2 -Iesp32 CompositeSimulator.cpp -o CompositeSimulator
+#include <stdio.h>
+#include <thread>
+#include <atomic>
+#include "Arduino.h"
+
+#include "../CompositeVideoSimple/CompositeGraphics.h"
+#include "../CompositeVideoSimple/Image.h"
+#include "../CompositeVideoSimple/CompositeOutput.h"
+#include "../CompositeVideoSimple/luni.h"
+#include "../CompositeVideoSimple/font6x8.h"
+#include "../CompositeVideoSimple/Sprite.h"
+
+//emulated DMA: plays the descriptor chain of one line and returns its end of frame descriptor
+lldesc_t *dmaDescriptor = 0;
+
+//descriptors the DMA was given with a buffer in external RAM, it would send garbage there
+int externalDescriptors = 0;
+
+lldesc_t *playDescriptors()
+{
+  if(!dmaDescriptor)
+    dmaDescriptor = (lldesc_t*)I2S0.out_link.addr;
+  while(true)
+  {
+    const unsigned short *s = (const unsigned short*)dmaDescriptor->buf;
+    if(simulator::external(s))
+      externalDescriptors++;
+    simulator::samples.insert(simulator::samples.end(), s, s + dmaDescriptor->length / sizeof(unsigned short));
+    lldesc_t *d = dmaDescriptor;
+    dmaDescriptor = dmaDescriptor->qe.stqe_next;
+    if(d->eof)
+      return d;
+  }
+}
+
+void raiseInterrupt()
+{
+  I2S0.int_st.out_eof = 1;
+  simulator::interruptHandler(simulator::interruptArg);
+  I2S0.int_st.out_eof = 0;
+}
+
+//plays a line and raises the end of frame interrupt right away
+void playDMALine()
+{
+  I2S0.out_eof_des_addr = (uintptr_t)playDescriptors();
+  raiseInterrupt();
+}
+
+//refill timing of the interrupt backend in modelled ESP32 cycles. the DMA starts a line every lineMicros and
+//the end of a line raises the interrupt, which is taken once the core is free. it costs a fixed time, a time per
+//queued line and a time per encoded sample. a line is late if the interrupt that queued it ended after the DMA started it
+class RefillTiming
+{
+  public:
+  CompositeOutput &composite;
+  double cyclesPerSample;
+  static constexpr double entryCycles = 500;
+  static constexpr double cyclesPerLine = 200;
+  double lineCycles;
+  //lines the DMA started and the end of frame descriptor of each
+  int played;
+  std::vector<uintptr_t> eofDescriptors;
+  //cycle each queued line was done at, by line number
+  std::vector<double> queuedAt;
+  bool pending;
+  double pendingSince;
+  double busyUntil;
+  double busyCycles;
+  double longest;
+  int lateLines;
+  int minLead;
+
+  RefillTiming(CompositeOutput &composite_, double cyclesPerSample_)
+    :composite(composite_),
+    cyclesPerSample(cyclesPerSample_)
+  {
+    lineCycles = composite.properties.lineMicros * 240;
+    played = 0;
+    //the ring is filled before the DMA starts
+    queuedAt.assign(composite.dmaLinesQueued, 0);
+    pending = false;
+    pendingSince = busyUntil = busyCycles = longest = 0;
+    lateLines = 0;
+    minLead = 1 << 30;
+  }
+
+  //runs the interrupts that come before the next line starts, then plays that line
+  void playLine()
+  {
+    while(true)
+    {
+      double start = played * lineCycles;
+      if(!pending || start <= std::max(pendingSince, busyUntil))
+        break;
+      interrupt(std::max(pendingSince, busyUntil));
+    }
+    double start = played * lineCycles;
+    //the previous line ends as this one starts
+    if(played && !pending)
+    {
+      pending = true;
+      pendingSince = start;
+    }
+    int lead = 0;
+    while(played + lead < (int)queuedAt.size() && queuedAt[played + lead] <= start)
+      lead++;
+    if(!lead)
+      lateLines++;
+    minLead = std::min(minLead, lead);
+    eofDescriptors.push_back((uintptr_t)playDescriptors());
+    played++;
+  }
+
+  void interrupt(double start)
+  {
+    //the handler clears the interrupt first and sees the last line that ended before it started
+    pending = false;
+    int finished = std::min((int)(start / lineCycles), played);
+    I2S0.out_eof_des_addr = eofDescriptors[finished - 1];
+    unsigned int queued = composite.dmaLinesQueued;
+    int samples = composite.samplesEncoded;
+    raiseInterrupt();
+    samples = composite.samplesEncoded - samples;
+    //the count restarts at the end of a frame
+    if(samples < 0)
+      samples += composite.samplesEncodedFrame;
+    int lines = composite.dmaLinesQueued - queued;
+    double cycles = entryCycles + lines * cyclesPerLine + samples * cyclesPerSample;
+    busyUntil = start + cycles;
+    busyCycles += cycles;
+    longest = std::max(longest, cycles);
+    for(int i = 0; i < lines; i++)
+      queuedAt.push_back(busyUntil);
+  }
+};
+RefillTiming *refillTiming = 0;
+
+//scanline renderer that gives the rows of a drawn frame, its stream has to be the same as the one of the frame
+CompositeGraphics *scanlineSource = 0;
+
+void renderScanline(int y, char *pixels)
+{
+  memcpy(pixels, scanlineSource->frame[y], scanlineSource->xres);
+}
+
+//sprites moving over the scene. they all cross the same rows, so up to maxSpritesPerLine of them share a line
+const int spriteXres = 32;
+const int spriteYres = 24;
+unsigned char spritePixels[spriteXres * spriteYres];
+std::vector<Sprite> sprites;
+
+void initSprites(int count)
+{
+  //a ring with a transparent center and corners
+  for(int y = 0; y < spriteYres; y++)
+    for(int x = 0; x < spriteXres; x++)
+    {
+      double dx = (x - spriteXres * 0.5 + 0.5) / (spriteXres * 0.5), dy = (y - spriteYres * 0.5 + 0.5) / (spriteYres * 0.5);
+      double r = dx * dx + dy * dy;
+      spritePixels[y * spriteXres + x] = r < 1 && r > 0.3 ? 10 + (x + y) % 40 : 0;
+    }
+  for(int i = 0; i < count; i++)
+    sprites.push_back(Sprite(spriteXres, spriteYres, spritePixels, 0, i % 5));
+}
+
+void moveSprites(int frame, int width, int height)
+{
+  for(int i = 0; i < (int)sprites.size(); i++)
+    sprites[i].setPosition((i * 23 + frame * 7) % (width - spriteXres), height / 2 - spriteYres / 2 + (i % 3) * 4 - 4 + frame % 5);
+}
+
+//triple buffering under load: a render thread draws frames as fast as it can while an output thread sends them.
+//every frame fills all rows with its own gray level, a field showing more than one level was torn.
+//the render thread also checks for every row it writes that the buffer isn't the one the output shows
+struct TripleBufferingTest
+{
+  CompositeGraphics *graphics;
+  std::atomic<char**> shown;
+  std::atomic<bool> done;
+  std::atomic<int> ownershipViolations;
+  int drawn;
+};
+TripleBufferingTest tripleTest;
+
+void latchAndRecord(void *arg)
+{
+  CompositeGraphics::latchFrame(arg);
+  tripleTest.shown = tripleTest.graphics->frame;
+}
+
+void renderFrames(int frames)
+{
+  CompositeGraphics &g = *tripleTest.graphics;
+  for(int f = 1; f <= frames; f++)
+  {
+    g.begin();
+    char color = 1 + f % 50;
+    for(int y = 0; y < g.yres; y++)
+    {
+      if(g.backbuffer == tripleTest.shown.load())
+        tripleTest.ownershipViolations++;
+      g.xLine(0, g.xres, y, color);
+      //some frames are drawn slower than they're sent and some faster, so frames are shown several times and dropped
+      if(f % 3 == 0 && !(y & 31))
+        std::this_thread::yield();
+    }
+    g.end();
+    tripleTest.drawn++;
+  }
+  tripleTest.done = true;
+}
+
+int tripleBuffering(CompositeOutput::Mode mode, int frames)
+{
+  CompositeOutput composite(mode, 640, 400);
+  CompositeGraphics graphics(320, 200);
+  composite.init();
+  graphics.init(true);
+  tripleTest.graphics = &graphics;
+  tripleTest.shown = graphics.frame;
+  tripleTest.done = false;
+  tripleTest.ownershipViolations = 0;
+  tripleTest.drawn = 0;
+  composite.setVBlankCallback(latchAndRecord, &graphics);
+  std::thread renderer(renderFrames, frames);
+  int fields = 0, torn = 0, changes = 0;
+  int lastLevel = -1;
+  while(!tripleTest.done)
+  {
+    simulator::samples.clear();
+    composite.sendFrameHalfResolution(&graphics.frame);
+    //level of the middle of each picture line, by field
+    int level[2] = {-1, -1};
+    bool fieldTorn[2] = {false, false};
+    for(int l = 0; l < composite.frameLines; l++)
+    {
+      int y = composite.lineProgram[l];
+      if(y < 0)
+        continue;
+      int v = simulator::samples[l * composite.samplesLine + composite.samplesActiveStart + composite.targetXres / 2] >> 8;
+      if(level[y & 1] < 0)
+        level[y & 1] = v;
+      else if(level[y & 1] != v)
+        fieldTorn[y & 1] = true;
+    }
+    for(int i = 0; i < 2; i++)
+    {
+      fields++;
+      torn += fieldTorn[i];
+      if(level[i] != lastLevel)
+        changes++;
+      lastLevel = level[i];
+    }
+  }
+  renderer.join();
+  printf("triple buffering: %d frames drawn, %d fields sent, the shown frame changed %d times\n", tripleTest.drawn, fields, changes);
+  printf("                  %d torn fields, %d rows written to the shown buffer\n", torn, tripleTest.ownershipViolations.load());
+  return torn || tripleTest.ownershipViolations ? 1 : 0;
+}
+
+//the scene of CompositeVideoSimple
+void draw(CompositeGraphics &graphics, Image<CompositeGraphics> &image, int frame)
+{
+  graphics.begin(0);
+  image.draw(graphics, 200, 10);
+  graphics.fillRect(27, 18, 160, 30, 10);
+  graphics.rect(27, 18, 160, 30, 20);
+  graphics.setTextColor(50);
+  graphics.setCursor(30, 20);
+  graphics.print((char*)"hello!");
+  graphics.print((char*)"\nrendered frame: ");
+  graphics.print(frame, 10, 4);
+  graphics.print((char*)"\n        in hex: ");
+  graphics.print(frame, 16, 4);
+  for(int i = 0; i <= 100; i++)
+  {
+    graphics.line(50, i + 60, 50 + i, 160, i / 2);
+    graphics.line(150, 160 - i, 50 + i, 60, i / 2);
+  }
+  graphics.dot(20, 190, 10);
+  graphics.end();
+}
+
+//only redraws the frame counter on top of the last frame
+void drawCounter(CompositeGraphics &graphics, int frame)
+{
+  graphics.begin();
+  graphics.fillRect(126, 28, 24, 16, 10);
+  graphics.setCursor(126, 28);
+  graphics.print(frame, 10, 4);
+  graphics.setCursor(126, 36);
+  graphics.print(frame, 16, 4);
+  graphics.end();
+}
+
+class Decoder
+{
+  public:
+  const TechProperties &properties;
+  double samplesPerMicro;
+  int levelBlank;
+  int levelBlack;
+  int levelWhite;
+  int lineSamples;
+
+  int width;
+  int height;
+  unsigned char *pixels;
+  bool progressive;
+  int fields;
+  int fieldLines[2];
+
+  Decoder(const TechProperties &properties_, bool progressive_, double Vcc = 3.3)
+    :properties(properties_),
+    progressive(progressive_)
+  {
+    samplesPerMicro = 160000000.0 / 3.0 / 2.0 / 2.0 * 0.000001;
+    double dacPerVolt = 255.0 / Vcc;
+    levelBlank = (properties.blankVolts - properties.syncVolts) * dacPerVolt + 0.5;
+    levelBlack = (properties.blackVolts - properties.syncVolts) * dacPerVolt + 0.5;
+    levelWhite = (properties.whiteVolts - properties.syncVolts) * dacPerVolt + 0.5;
+    lineSamples = samplesPerMicro * properties.lineMicros + 0.5;
+    width = samplesPerMicro * (properties.lineMicros - properties.blankEndMicros - properties.backMicros);
+    height = progressive ? properties.lines / 2 : properties.lines;
+    pixels = (unsigned char*)calloc(width * height, 1);
+    fields = 0;
+    fieldLines[0] = fieldLines[1] = 0;
+  }
+
+  ~Decoder()
+  {
+    free(pixels);
+  }
+
+  inline int level(const std::vector<unsigned short> &s, int i)
+  {
+    //samples come in swapped pairs
+    return s[i ^ 1] >> 8;
+  }
+
+  //finds the sync pulses, splits the stream into fields and lines and rebuilds the picture.
+  //interlaced fields are woven into one frame, the even field on the even rows.
+  //the stream has to start at the beginning of a line
+  void decode(const std::vector<unsigned short> &s)
+  {
+    int threshold = levelBlank / 2;
+    //start of the last horizontal sync, the line grid the vsync pulses are compared to
+    int lastHSync = 0;
+    int field = -1;
+    int line = 0;
+    bool inVSync = false;
+    int n = s.size() & ~1;
+    for(int i = 0; i < n;)
+    {
+      if(level(s, i) > threshold)
+      {
+        i++;
+        continue;
+      }
+      int start = i;
+      while(i < n && level(s, i) <= threshold)
+        i++;
+      double micros = (i - start) / samplesPerMicro;
+      if(micros > properties.syncMicros * 2)
+      {
+        //broad pulse: the first one of a vertical sync tells the field by its position on the line
+        if(!inVSync)
+        {
+          int offset = (start - lastHSync) % lineSamples;
+          field = (!progressive && offset > lineSamples / 4 && offset < lineSamples * 3 / 4) ? 1 : 0;
+          fields++;
+          line = 0;
+        }
+        inVSync = true;
+      }
+      else if(micros > (properties.syncMicros + properties.shortVSyncMicros) * 0.5)
+      {
+        //horizontal sync, starts a line
+        inVSync = false;
+        lastHSync = start;
+        if(field < 0 || start + lineSamples > n)
+          continue;
+        int row = progressive ? line : line * 2 + field;
+        if(row >= 0 && row < height)
+        {
+          int x0 = start + samplesPerMicro * properties.blankEndMicros;
+          for(int x = 0; x < width; x++)
+          {
+            int v = (level(s, x0 + x) - levelBlack) * 255 / (levelWhite - levelBlack);
+            pixels[row * width + x] = v < 0 ? 0 : (v > 255 ? 255 : v);
+          }
+        }
+        line++;
+        fieldLines[field] = line;
+      }
+      //equalizing pulses are skipped
+    }
+  }
+
+  bool writePGM(const char *fileName)
+  {
+    FILE *f = fopen(fileName, "wb");
+    if(!f) return false;
+    fprintf(f, "P5\n%d %d\n255\n", width, height);
+    fwrite(pixels, 1, width * height, f);
+    fclose(f);
+    return true;
+  }
+};
+
+//audio ramp that changes with every sample, so the samples can be counted on the DAC2 channel
+AudioBuffer *audioBuffer = 0;
+unsigned char audioCounter = 0;
+
+void fillAudio(void *arg)
+{
+  while(audioBuffer->write(audioCounter))
+    audioCounter++;
+}
+//a tile map has to give the same picture as the same text printed with CompositeGraphics on a frame cleared to the back color.
+//checked with a back color and with a transparent one, which is black behind the map. the map is a column narrower
+//than the frame, so the padding after the last column is checked too
+int tileMapCheck(CompositeOutput::Mode mode, bool full)
+{
+  bool progressive = mode == CompositeOutput::PAL_PROGRESSIVE || mode == CompositeOutput::NTSC_PROGRESSIVE;
+  CompositeOutput composite(mode, 640, progressive ? 200 : 400);
+  composite.init();
+  int xres = full ? composite.targetXres : composite.targetXres / 2;
+  //the progressive modes show every row in both fields
+  int yres = (full || progressive) ? composite.targetYres : composite.targetYres / 2;
+  Font<CompositeGraphics> font(6, 8, font6x8::pixels);
+  TileMap map(xres / 6 - 1, yres / 8, font);
+  map.init();
+  CompositeGraphics graphics(xres, yres);
+  graphics.init();
+  graphics.setFont(font);
+  const int backColors[] = {10, -1};
+  int failed = 0;
+  for(int b = 0; b < 2; b++)
+  {
+    map.clear();
+    map.setTextColor(50, backColors[b]);
+    graphics.begin(backColors[b] < 0 ? 0 : backColors[b]);
+    graphics.setTextColor(50, backColors[b]);
+    for(int row = 0; row < map.rows; row++)
+    {
+      char text[200];
+      int n = 0;
+      for(int i = 0; i < map.columns; i++)
+        text[n++] = 32 + (row * 7 + i) % 95;
+      text[n] = 0;
+      map.setCursor(0, row);
+      map.print(text);
+      graphics.setCursor(0, row * 8);
+      graphics.print(text);
+    }
+    graphics.end();
+    simulator::samples.clear();
+    if(full)
+      composite.sendFrameFullResolution(&graphics.frame);
+    else
+      composite.sendFrameHalfResolution(&graphics.frame);
+    std::vector<unsigned short> frame = simulator::samples;
+    simulator::samples.clear();
+    composite.sendFrameTiles(map, full);
+    size_t i = 0;
+    while(i < frame.size() && i < simulator::samples.size() && frame[i] == simulator::samples[i])
+      i++;
+    if(i == frame.size() && i == simulator::samples.size())
+      printf("tile map %dx%d with back color %d: all %d samples are the same as the printed frame\n", map.columns, map.rows, backColors[b], (int)i);
+    else
+    {
+      printf("tile map %dx%d with back color %d: first difference at sample %d (line %d)\n", map.columns, map.rows, backColors[b], (int)i, (int)(i / composite.samplesLine));
+      failed = 1;
+    }
+  }
+  return failed;
+}
+
+//background jobs in the blank lines: a short job, one that loops while its budget lasts and one that overruns its budget
+//once by more than any window. the overrunning one must never be started again, the others only run after blank lines,
+//stop once removed and the sent stream has to be the same as without jobs
+struct TestJob
+{
+  CompositeOutput *composite;
+  //cycles the job spins, 0 loops until jobCyclesLeft runs out
+  unsigned int cycles;
+  int calls;
+  int callsAfterPictureLines;
+};
+
+void runTestJob(void *arg)
+{
+  TestJob &job = *(TestJob*)arg;
+  CompositeOutput &composite = *job.composite;
+  job.calls++;
+  if(composite.lineProgram[composite.renderingLine] >= 0)
+    job.callsAfterPictureLines++;
+  unsigned int start = ESP.getCycleCount();
+  if(job.cycles)
+    while(ESP.getCycleCount() - start < job.cycles);
+  else
+    while(composite.jobCyclesLeft() > 100);
+}
+
+int jobsCheck(CompositeOutput::Mode mode, CompositeOutput::Backend backend, int frames)
+{
+  CompositeGraphics graphics(320, 200);
+  graphics.init();
+  graphics.begin(0);
+  graphics.fillRect(40, 40, 240, 120, 30);
+  graphics.end();
+  if(backend == CompositeOutput::DMA_RING)
+    simulator::dmaWait = playDMALine;
+  //the same frames without and with jobs, each from a fresh output so the ring starts the same
+  std::vector<unsigned short> streams[2];
+  TestJob jobs[3];
+  int ids[3];
+  int callsBeforeRemoval = 0;
+  int jobLoad = 0;
+  unsigned int overruns[3];
+  for(int pass = 0; pass < 2; pass++)
+  {
+    CompositeOutput composite(mode, 640, 400);
+    dmaDescriptor = 0;
+    composite.init(backend);
+    if(pass)
+    {
+      const unsigned int cycles[3] = {500, 0, composite.lineCycles * 8};
+      const unsigned int budgets[3] = {3000, 4000, 1000};
+      for(int i = 0; i < 3; i++)
+      {
+        jobs[i].composite = &composite;
+        jobs[i].cycles = cycles[i];
+        jobs[i].calls = jobs[i].callsAfterPictureLines = 0;
+        ids[i] = composite.addJob(runTestJob, &jobs[i], budgets[i]);
+      }
+    }
+    simulator::samples.clear();
+    for(int f = 0; f < frames; f++)
+    {
+      //the short job is removed halfway
+      if(pass && f == frames / 2)
+      {
+        composite.removeJob(ids[0]);
+        callsBeforeRemoval = jobs[0].calls;
+      }
+      composite.sendFrameHalfResolution(&graphics.frame);
+    }
+    streams[pass] = simulator::samples;
+    if(pass)
+    {
+      jobLoad = composite.jobLoad;
+      for(int i = 0; i < 3; i++)
+        overruns[i] = composite.jobs[ids[i]].overruns;
+    }
+  }
+  simulator::dmaWait = 0;
+  bool sameStream = streams[0] == streams[1];
+  const char *names[3] = {"short", "looping", "overrunning"};
+  bool failed = !sameStream || jobs[2].calls != 1 || jobs[0].calls != callsBeforeRemoval || !jobs[0].calls || !jobs[1].calls;
+  for(int i = 0; i < 3; i++)
+  {
+    printf("%-11s job: %d runs, %d overruns, %d after picture lines\n", names[i], jobs[i].calls, overruns[i], jobs[i].callsAfterPictureLines);
+    failed |= jobs[i].callsAfterPictureLines != 0;
+  }
+  printf("the short job ran %d times after it was removed, job load %d%%, %s stream as without jobs\n",
+    jobs[0].calls - callsBeforeRemoval, jobLoad, sameStream ? "same" : "different");
+  return failed ? 1 : 0;
+}
+
+unsigned int checksum(const std::vector<unsigned short> &s)
+{
+  //FNV-1a over the raw sample stream, changes whenever a single sample does
+  unsigned int h = 2166136261u;
+  for(size_t i = 0; i < s.size(); i++)
+  {
+    h = (h ^ (s[i] & 255)) * 16777619u;
+    h = (h ^ (s[i] >> 8)) * 16777619u;
+  }
+  return h;
+}
+
+void usage()
+{
+  printf("usage: CompositeSimulator [pal|ntsc|pal-progressive|ntsc-progressive] [half|full] [driver|ring|interrupt]\n");
+  printf("                          [-frames n] [-counter] [-cache bytes] [-samples] [-gray4] [-mono]\n");
+  printf("                          [-audio rate] [-copper] [-scroll x y] [-playfield]\n");
+  printf("                          [-psram] [-prefetch n] [-timing cycles] [-scanlines] [-sprites n] [-triple n] [-tiles] [-jobs]\n");
+  printf("                          [-pgm file] [-raw file] [-compare file]\n");
+  printf("  -scanlines    sends the frame through a scanline renderer copying its rows, compare with the stream of the frame\n");
+  printf("  -sprites n    moves n sprites over the frame, the most of them on a line and their work per line are reported\n");
+  printf("                against the line time at the -timing cycles per sample (4 without), fails if a line doesn't fit\n");
+  printf("  -triple n     stress test of triple buffering: n frames drawn by a thread while another one sends them,\n");
+  printf("                checks that no field is torn and that the shown buffer is never drawn to\n");
+  printf("  -tiles        checks that a tile map gives the same picture as its text printed on a frame\n");
+  printf("  -jobs         runs background jobs in the blank lines of -frames frames (20 without) with the driver or the ring,\n");
+  printf("                checks that they only run there, an overrunning job is held back and the stream doesn't change\n");
+  printf("  -compare file compares the stream sample by sample with one saved with -raw, e.g. by another backend\n");
+  printf("  -counter      every frame after the first only redraws the frame counter\n");
+  printf("  -cache bytes  keeps encoded lines of unchanged rows\n");
+  printf("  -samples      draws the frame in DAC samples (PIXELS_SAMPLES)\n");
+  printf("  -gray4        draws the frame with 4 bit pixels (PIXELS_GRAY4)\n");
+  printf("  -mono         draws the frame with 1 bit pixels (PIXELS_MONO)\n");
+  printf("  -psram        allocates the frame buffers in external RAM\n");
+  printf("  -prefetch n   copies the rows n lines ahead into internal RAM\n");
+  printf("  -audio rate   stereo output with an audio ramp of the given sample rate on DAC2\n");
+  printf("  -scroll x y   shows the frame from pixel x and row y on\n");
+  printf("  -playfield    the frame wraps around horizontally when scrolled instead of moving in black\n");
+  printf("  -timing cycles  interrupt backend: plays the lines at the line rate with the interrupt taking the given ESP32 cycles\n");
+  printf("                per encoded sample and reports the lines that weren't refilled in time\n");
+  printf("  -copper       mirrors the upper half of the frame into a darkening, waving lower half with a copper list\n");
+}
+
+int main(int argc, char **argv)
+{
+  CompositeOutput::Mode mode = CompositeOutput::NTSC;
+  CompositeOutput::Backend backend = CompositeOutput::I2S_DRIVER;
+  bool full = false;
+  int frames = 1;
+  bool counter = false;
+  int cacheBytes = 0;
+  PixelFormat format = PIXELS_GRAY8;
+  int audioRate = 0;
+  bool useCopper = false;
+  bool psram = false;
+  int prefetchLines = 0;
+  double timingCycles = 0;
+  int scrollX = 0, scrollY = 0;
+  bool playfield = false;
+  const char *pgmFile = "composite.pgm";
+  const char *rawFile = 0;
+  const char *compareFile = 0;
+  bool scanlines = false;
+  int spriteCount = 0;
+  int tripleFrames = 0;
+  bool tiles = false;
+  bool jobs = false;
+  for(int i = 1; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "pal")) mode = CompositeOutput::PAL;
+    else if(!strcmp(argv[i], "ntsc")) mode = CompositeOutput::NTSC;
+    else if(!strcmp(argv[i], "pal-progressive")) mode = CompositeOutput::PAL_PROGRESSIVE;
+    else if(!strcmp(argv[i], "ntsc-progressive")) mode = CompositeOutput::NTSC_PROGRESSIVE;
+    else if(!strcmp(argv[i], "half")) full = false;
+    else if(!strcmp(argv[i], "full")) full = true;
+    else if(!strcmp(argv[i], "driver")) backend = CompositeOutput::I2S_DRIVER;
+    else if(!strcmp(argv[i], "ring")) backend = CompositeOutput::DMA_RING;
+    else if(!strcmp(argv[i], "interrupt")) backend = CompositeOutput::DMA_INTERRUPT;
+    else if(!strcmp(argv[i], "-frames") && i + 1 < argc) frames = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-counter")) counter = true;
+    else if(!strcmp(argv[i], "-samples")) format = PIXELS_SAMPLES;
+    else if(!strcmp(argv[i], "-gray4")) format = PIXELS_GRAY4;
+    else if(!strcmp(argv[i], "-mono")) format = PIXELS_MONO;
+    else if(!strcmp(argv[i], "-psram")) psram = true;
+    else if(!strcmp(argv[i], "-prefetch") && i + 1 < argc) prefetchLines = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-timing") && i + 1 < argc) timingCycles = atof(argv[++i]);
+    else if(!strcmp(argv[i], "-audio") && i + 1 < argc) audioRate = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-copper")) useCopper = true;
+    else if(!strcmp(argv[i], "-scroll") && i + 2 < argc)
+    {
+      scrollX = atoi(argv[++i]);
+      scrollY = atoi(argv[++i]);
+    }
+    else if(!strcmp(argv[i], "-playfield")) playfield = true;
+    else if(!strcmp(argv[i], "-scanlines")) scanlines = true;
+    else if(!strcmp(argv[i], "-triple") && i + 1 < argc) tripleFrames = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-tiles")) tiles = true;
+    else if(!strcmp(argv[i], "-jobs")) jobs = true;
+    else if(!strcmp(argv[i], "-sprites") && i + 1 < argc) spriteCount = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-cache") && i + 1 < argc) cacheBytes = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-pgm") && i + 1 < argc) pgmFile = argv[++i];
+    else if(!strcmp(argv[i], "-raw") && i + 1 < argc) rawFile = argv[++i];
+    else if(!strcmp(argv[i], "-compare") && i + 1 < argc) compareFile = argv[++i];
+    else
+    {
+      usage();
+      return 1;
+    }
+  }
+
+  if(tripleFrames)
+    return tripleBuffering(mode, tripleFrames);
+  if(tiles)
+    return tileMapCheck(mode, full);
+  if(jobs)
+    return jobsCheck(mode, backend, frames > 1 ? frames : 20);
+
+  const int XRES = 320;
+  const int YRES = 200;
+  //progressive modes only have half the lines
+  bool progressive = mode == CompositeOutput::PAL_PROGRESSIVE || mode == CompositeOutput::NTSC_PROGRESSIVE;
+  CompositeOutput composite(mode, XRES * 2, progressive ? YRES : YRES * 2);
+  //full resolution draws the scene on a buffer of the output resolution
+  CompositeGraphics graphics(full ? composite.targetXres : XRES, full ? composite.targetYres : YRES);
+  Image<CompositeGraphics> luni0(luni::xres, luni::yres, luni::pixels);
+  Font<CompositeGraphics> font(6, 8, font6x8::pixels);
+  if(audioRate)
+  {
+    audioBuffer = new AudioBuffer(audioRate, 4096);
+    audioBuffer->init();
+    fillAudio(0);
+  }
+  composite.init(backend, audioBuffer);
+  if(audioBuffer)
+    composite.setVBlankCallback(fillAudio);
+  graphics.setPixelFormat(format, composite.pixelWords, full);
+  graphics.setExternalMemory(psram);
+  graphics.init();
+  graphics.setFont(font);
+  if(backend == CompositeOutput::DMA_RING)
+    simulator::dmaWait = playDMALine;
+  if(cacheBytes)
+    composite.setLineCache(cacheBytes, CompositeGraphics::rowVersions);
+  composite.setPrefetch(prefetchLines);
+
+  //water reflection: the lower half shows the upper half mirrored, darker with every line and waving sideways
+  CopperList copper(graphics.yres);
+  static unsigned int palettes[8][256];
+  if(useCopper)
+  {
+    copper.init();
+    for(int i = 0; i < 8; i++)
+      composite.initPalette(palettes[i], -i * 2, 224 - i * 16);
+    int half = graphics.yres / 2;
+    for(int y = half; y < graphics.yres; y++)
+    {
+      int d = y - half;
+      copper.setRow(y, half - 1 - d);
+      copper.setPalette(y, palettes[d * 8 / (graphics.yres - half)]);
+      copper.setOffset(y, (int)(3 * sin(d * 0.4)));
+    }
+    copper.commit();
+    //nothing is sent yet, so the list can be taken over right away instead of at the first vertical blank
+    copper.latch();
+    composite.setCopperList(&copper);
+  }
+
+  if(scanlines && format != PIXELS_GRAY8)
+  {
+    printf("scanline renderers only give 8 bit pixels\n");
+    return 1;
+  }
+  scanlineSource = &graphics;
+  if(spriteCount)
+  {
+    initSprites(spriteCount);
+    composite.setSprites(&sprites[0], spriteCount);
+  }
+
+  if(playfield)
+    composite.setPlayfield(graphics.xres, graphics.yres);
+  //set right away, setScroll would only take it over at the first vertical blank
+  composite.scrollX = scrollX;
+  composite.scrollY = scrollY;
+
+  draw(graphics, luni0, 0);
+  simulator::samples.clear();
+  //the DMA timing starts with the picture, the ring is already full of blank lines then
+  if(timingCycles > 0 && backend == CompositeOutput::DMA_INTERRUPT)
+  {
+    if(scanlines)
+      composite.setScanlineRenderer(renderScanline, full);
+    else if(full)
+      composite.setFrameFullResolution(&graphics.frame, format);
+    else
+      composite.setFrameHalfResolution(&graphics.frame, format);
+    refillTiming = new RefillTiming(composite, timingCycles);
+  }
+  unsigned int encodeCycles = 0;
+  for(int f = 0; f < frames; f++)
+  {
+    if(counter && f)
+      drawCounter(graphics, f);
+    if(spriteCount)
+    {
+      //the order by priority is only updated at the start of a frame
+      moveSprites(f, full ? composite.targetXres : composite.targetXres / 2, graphics.yres);
+      composite.setSprites(&sprites[0], spriteCount);
+    }
+    unsigned int t = ESP.getCycleCount();
+    if(backend == CompositeOutput::DMA_INTERRUPT)
+    {
+      if(scanlines)
+        composite.setScanlineRenderer(renderScanline, full);
+      else if(full)
+        composite.setFrameFullResolution(&graphics.frame, format);
+      else
+        composite.setFrameHalfResolution(&graphics.frame, format);
+      for(int l = 0; l < composite.frameLines; l++)
+        if(refillTiming)
+          refillTiming->playLine();
+        else
+          playDMALine();
+    }
+    else if(scanlines)
+      composite.sendFrameScanlines(renderScanline, full);
+    else if(full)
+      composite.sendFrameFullResolution(&graphics.frame, format);
+    else
+      composite.sendFrameHalfResolution(&graphics.frame, format);
+    encodeCycles += ESP.getCycleCount() - t;
+  }
+  //play what's still queued in the ring
+  if(backend == CompositeOutput::DMA_RING)
+    while(composite.dmaLinesDone < composite.dmaLinesQueued)
+      playDMALine();
+  if(backend == CompositeOutput::DMA_INTERRUPT)
+  {
+    for(int l = 0; l < 2; l++)
+      if(refillTiming)
+        refillTiming->playLine();
+      else
+        playDMALine();
+  }
+  //the ring starts with two blank lines, those are dropped to get the same stream for all backends
+  int channels = audioBuffer ? 2 : 1;
+  int skip = backend == CompositeOutput::I2S_DRIVER ? 0 : 2 * composite.samplesLine * channels;
+  std::vector<unsigned short> captured(simulator::samples.begin() + skip, simulator::samples.begin() + skip + frames * composite.frameLines * composite.samplesLine * channels);
+  std::vector<unsigned short> stream;
+  if(audioBuffer)
+  {
+    //stereo frames are 32 bit words with the video in the upper half, it's put back in the order of the mono stream
+    int n = captured.size() / 2;
+    stream.resize(n);
+    int changes = 0;
+    for(int i = 0; i < n; i++)
+    {
+      stream[i] = captured[(i ^ 1) * 2 + 1];
+      if(i && captured[i * 2] != captured[i * 2 - 2])
+        changes++;
+    }
+    printf("audio: %d samples on DAC2, %.1f expected at %d Hz, %d underruns\n", changes, (double)n * audioRate * 3 / CompositeOutput::audioWrap, audioRate, audioBuffer->underruns);
+  }
+  else
+    stream = captured;
+
+  printf("%d lines per frame, %d x %d active, %d samples per line\n", composite.frameLines, composite.targetXres, composite.targetYres, composite.samplesLine);
+  printf("%d samples encoded per frame, %.1f us per frame on the host\n", composite.samplesEncodedFrame, encodeCycles / 240.0 / frames);
+  printf("%d samples encoded per field in the last frame, %d lines from the cache\n", composite.samplesEncodedFrame / 2, composite.lineCacheHitsFrame);
+  printf("late lines: %d, rows not prefetched: %d\n", composite.lateLines, composite.prefetchMisses);
+  printf("stream: %d samples, checksum %08x\n", (int)stream.size(), checksum(stream));
+  if(externalDescriptors)
+  {
+    printf("the DMA was given %d buffers in external RAM\n", externalDescriptors);
+    return 1;
+  }
+  if(spriteCount)
+  {
+#if COMPOSITE_STATISTICS
+    //the work drawSprites counted, in modelled cycles: every sprite pixel it goes through writes one or two samples
+    double cyclesPerSample = timingCycles > 0 ? timingCycles : 4;
+    double lineCycles = composite.properties.lineMicros * 240;
+    int spriteSamples = composite.spritePixelsLineMax * (full ? 1 : 2);
+    double cycles = (composite.targetXres + spriteSamples) * cyclesPerSample;
+    printf("sprites: up to %d of %d on a line, %d dropped, at most %d samples written by sprites on a line\n", composite.spritesLineMax, spriteCount, composite.spriteOverflows, spriteSamples);
+    printf("         %d samples with the line, %.0f%% of a line at %g cycles per sample\n", composite.targetXres + spriteSamples, 100 * cycles / lineCycles, cyclesPerSample);
+    if(cycles > lineCycles)
+    {
+      printf("the busiest sprite line doesn't fit into a line\n");
+      return 1;
+    }
+#else
+    printf("sprites: the sprite work is only counted with COMPOSITE_STATISTICS\n");
+#endif
+  }
+  if(refillTiming)
+    printf("refill timing at %g cycles per sample: %d lines not refilled in time, at least %d lines ahead, longest interrupt %.1f us, %.1f%% of the time in the interrupt\n",
+      timingCycles, refillTiming->lateLines, refillTiming->minLead, refillTiming->longest / 240, 100 * refillTiming->busyCycles / (refillTiming->played * refillTiming->lineCycles));
+
+  if(rawFile)
+  {
+    FILE *f = fopen(rawFile, "wb");
+    if(f)
+    {
+      fwrite(&stream[0], sizeof(unsigned short), stream.size(), f);
+      fclose(f);
+    }
+  }
+
+  if(compareFile)
+  {
+    FILE *f = fopen(compareFile, "rb");
+    if(!f)
+    {
+      printf("can't read %s\n", compareFile);
+      return 1;
+    }
+    std::vector<unsigned short> other;
+    unsigned short sample;
+    while(fread(&sample, sizeof(sample), 1, f) == 1)
+      other.push_back(sample);
+    fclose(f);
+    size_t n = std::min(other.size(), stream.size());
+    size_t i = 0;
+    while(i < n && other[i] == stream[i])
+      i++;
+    if(i == n && other.size() == stream.size())
+      printf("compare: all %d samples are the same as in %s\n", (int)n, compareFile);
+    else
+    {
+      printf("compare: first difference at sample %d (line %d) of %d / %d samples in %s\n", (int)i, (int)(i / composite.samplesLine), (int)stream.size(), (int)other.size(), compareFile);
+      return 1;
+    }
+  }
+
+  Decoder decoder(composite.properties, progressive);
+  decoder.decode(stream);
+  printf("decoded %d fields, %d + %d lines\n", decoder.fields, decoder.fieldLines[0], decoder.fieldLines[1]);
+  if(pgmFile && !decoder.writePGM(pgmFile))
+  {
+    printf("can't write %s\n", pgmFile);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,117 @@
+//models how far CompositeOutput has to prefetch rows of a frame in PSRAM to keep the line deadlines
+//with a given PSRAM latency. it replays the prefetch rules of the output on the line program of a mode
+//with modelled times instead of running the encoder.
+//build: g++ -O2 -Iesp32 PrefetchModel.cpp -o PrefetchModel
+
+#include <stdio.h>
+#include <vector>
+#include "Arduino.h"
+#include "../CompositeVideoSimple/CompositeOutput.h"
+
+//all times in microseconds
+struct Model
+{
+  double line;
+  double encode;
+  double copy;
+  //every row access stalls with this probability for the stall time
+  double stallChance;
+  double stall;
+  //lines the encoder may work ahead of the line that is sent (DMA ring: dmaRingLines - 2, interrupt: dmaRingLines - 1)
+  int slack;
+};
+
+unsigned int randomState = 1;
+double random01()
+{
+  randomState = randomState * 1103515245 + 12345;
+  return ((randomState >> 8) & 0xffff) / 65536.0;
+}
+
+double access(const Model &m)
+{
+  return m.copy + (random01() < m.stallChance ? m.stall : 0);
+}
+
+//returns the picture lines that were done after their deadline
+int run(CompositeOutput &composite, const Model &m, int distance, int frames, int &notPrefetched)
+{
+  int misses = 0;
+  double t = 0;
+  int done = 0;
+  std::vector<bool> ready(composite.frameLines, false);
+  notPrefetched = 0;
+  for(int f = 0; f < frames; f++)
+    for(int l = 0; l < composite.frameLines; l++)
+    {
+      int i = f * composite.frameLines + l;
+      //the line can be encoded once its slot in the ring is free and has to be done before it's sent
+      double release = (i - m.slack) * m.line;
+      double deadline = i * m.line;
+      if(t < release)
+        t = release;
+      double start = t;
+      if(done)
+        done--;
+      if(composite.lineProgram[l] >= 0)
+      {
+        if(distance && ready[l])
+          t += m.encode;
+        else
+        {
+          //the encoder reads the row from PSRAM itself
+          t += access(m) + m.encode;
+          notPrefetched++;
+        }
+        ready[l] = false;
+        if(t > deadline)
+          misses++;
+      }
+      while(done < distance)
+      {
+        if(done && t - start > m.line / 2)
+          break;
+        int next = (l + 1 + done) % composite.frameLines;
+        done++;
+        if(composite.lineProgram[next] < 0)
+          continue;
+        t += access(m);
+        ready[next] = true;
+      }
+    }
+  return misses;
+}
+
+int main(int argc, char **argv)
+{
+  CompositeOutput composite(CompositeOutput::NTSC, 640, 400);
+  composite.init();
+  const int frames = 300;
+  const int distances[] = {0, 1, 2, 4, 8, 16};
+  const double stalls[] = {0, 50, 100, 200, 400, 800};
+  printf("NTSC half resolution, %d frames. encoding 12us, copying a row 8us, 1%% of the row reads stall.\n", frames);
+  printf("picture lines done after their deadline (rows not prefetched) by prefetch distance and stall time\n");
+  for(int s = 0; s < 2; s++)
+  {
+    int slack = s ? CompositeOutput::dmaRingLines - 2 : CompositeOutput::dmaRingLines - 1;
+    printf("\nencoder %d lines ahead of the output (%s)\n", slack, s ? "DMA ring" : "interrupt");
+    printf("distance");
+    for(int j = 0; j < 6; j++)
+      printf(" %9.0fus stall", stalls[j]);
+    printf("\n");
+    for(int d = 0; d < 6; d++)
+    {
+      printf("%8d", distances[d]);
+      for(int j = 0; j < 6; j++)
+      {
+        Model m = {composite.properties.lineMicros, 12, 8, 0.01, stalls[j], slack};
+        randomState = 1;
+        int notPrefetched;
+        int misses = run(composite, m, distances[d], frames, notPrefetched);
+        printf(" %8d (%6d)", misses, notPrefetched);
+      }
+      printf("\n");
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+#pragma once
+//minimal stand-ins for the parts of Arduino, FreeRTOS and ESP-IDF CompositeOutput and CompositeGraphics use,
+//so both can be built on the host. the i2s driver and DMA write into simulator::samples
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <utility>
+
+using std::min;
+using std::max;
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define IRAM_ATTR
+
+#define MALLOC_CAP_DEFAULT (1 << 0)
+#define MALLOC_CAP_DMA (1 << 1)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_32BIT (1 << 3)
+#define MALLOC_CAP_INTERNAL (1 << 4)
+#define MALLOC_CAP_SPIRAM (1 << 5)
+namespace simulator
+{
+  //blocks that were allocated in external RAM, the DMA can't read them
+  static std::vector<std::pair<const char*, size_t> > externalBlocks;
+  static bool external(const void *p)
+  {
+    for(size_t i = 0; i < externalBlocks.size(); i++)
+      if((const char*)p >= externalBlocks[i].first && (const char*)p < externalBlocks[i].first + externalBlocks[i].second)
+        return true;
+    return false;
+  }
+}
+inline void *heap_caps_malloc(size_t size, int caps)
+{
+  void *p = malloc(size);
+  if(p && (caps & MALLOC_CAP_SPIRAM))
+    simulator::externalBlocks.push_back(std::make_pair((const char*)p, size));
+  return p;
+}
+inline void *heap_caps_calloc(size_t n, size_t size, int caps) { return calloc(n, size); }
+inline void heap_caps_free(void *p)
+{
+  for(size_t i = 0; i < simulator::externalBlocks.size(); i++)
+    if(simulator::externalBlocks[i].first == p)
+      simulator::externalBlocks.erase(simulator::externalBlocks.begin() + i--);
+  free(p);
+}
+inline size_t heap_caps_get_free_size(int caps) { return 0; }
+
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int TickType_t;
+#define portMAX_DELAY 0xffffffff
+#define pdTRUE 1
+#define pdFALSE 0
+#define portYIELD_FROM_ISR() do{}while(0)
+
+//cycles of a 240MHz core derived from the host clock
+class EspClass
+{
+  public:
+  uint32_t getCycleCount()
+  {
+    static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return (uint32_t)(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 240e6);
+  }
+
+  uint32_t getCpuFreqMHz()
+  {
+    return 240;
+  }
+};
+static EspClass ESP;
+
+inline unsigned long millis() { return ESP.getCycleCount() / 240000; }
+inline unsigned long micros() { return ESP.getCycleCount() / 240; }
+
+namespace simulator
+{
+  //everything that went out of the DAC in DMA order
+  static std::vector<unsigned short> samples;
+  //waiting for the DMA lets it play a line
+  static void (*dmaWait)() = 0;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return (TaskHandle_t)1; }
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {}
+inline void xTaskNotifyGive(TaskHandle_t task) {}
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+  if(simulator::dmaWait)
+    simulator::dmaWait();
+  return 1;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include "../Arduino.h"
+
+typedef int dac_channel_t;
+#define DAC_CHANNEL_1 1
+#define DAC_CHANNEL_2 2
+
+inline esp_err_t dac_output_enable(dac_channel_t channel) { return ESP_OK; }
+inline esp_err_t dac_i2s_enable() { return ESP_OK; }
@@ -0,0 +1,47 @@
+#pragma once
+#include "../Arduino.h"
+
+typedef int i2s_port_t;
+typedef int i2s_mode_t;
+typedef int i2s_bits_per_sample_t;
+typedef int i2s_channel_fmt_t;
+typedef int i2s_comm_format_t;
+#define I2S_NUM_0 0
+#define I2S_MODE_MASTER 1
+#define I2S_MODE_TX 4
+#define I2S_MODE_DAC_BUILT_IN 16
+#define I2S_BITS_PER_SAMPLE_16BIT 16
+#define I2S_CHANNEL_FMT_RIGHT_LEFT 0
+#define I2S_CHANNEL_FMT_ONLY_RIGHT 3
+#define I2S_COMM_FORMAT_I2S_MSB 2
+#ifndef ESP_INTR_FLAG_LEVEL1
+#define ESP_INTR_FLAG_LEVEL1 (1 << 1)
+#endif
+
+typedef struct
+{
+  i2s_mode_t mode;
+  int sample_rate;
+  i2s_bits_per_sample_t bits_per_sample;
+  i2s_channel_fmt_t channel_format;
+  i2s_comm_format_t communication_format;
+  int intr_alloc_flags;
+  int dma_buf_count;
+  int dma_buf_len;
+}i2s_config_t;
+
+inline esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t *config, int queueSize, void *queue) { return ESP_OK; }
+inline esp_err_t i2s_set_pin(i2s_port_t port, void *pins) { return ESP_OK; }
+inline esp_err_t i2s_set_sample_rates(i2s_port_t port, int rate) { return ESP_OK; }
+
+inline esp_err_t i2s_write(i2s_port_t port, const void *src, size_t size, size_t *written, TickType_t ticks)
+{
+  const unsigned short *s = (const unsigned short *)src;
+  simulator::samples.insert(simulator::samples.end(), s, s + size / sizeof(unsigned short));
+  *written = size;
+  return ESP_OK;
+}
+
+#define SET_PERI_REG_BITS(reg, mask, value, shift)
+#define I2S_CLKM_CONF_REG(i) (i)
+#define I2S_SAMPLE_RATE_CONF_REG(i) (i)
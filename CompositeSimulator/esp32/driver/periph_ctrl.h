@@ -0,0 +1,4 @@
+#pragma once
+
+#define PERIPH_I2S0_MODULE 0
+inline void periph_module_enable(int module) {}
@@ -0,0 +1,22 @@
+#pragma once
+#include "Arduino.h"
+
+typedef void *intr_handle_t;
+typedef void (*intr_handler_t)(void *arg);
+#define ETS_I2S0_INTR_SOURCE 32
+#define ESP_INTR_FLAG_LEVEL1 (1 << 1)
+
+namespace simulator
+{
+  static intr_handler_t interruptHandler = 0;
+  static void *interruptArg = 0;
+}
+
+inline esp_err_t esp_intr_alloc(int source, int flags, intr_handler_t handler, void *arg, intr_handle_t *ret)
+{
+  simulator::interruptHandler = handler;
+  simulator::interruptArg = arg;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_intr_enable(intr_handle_t handle) { return ESP_OK; }
@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+
+typedef struct lldesc_s
+{
+  volatile uint32_t size :12, length:12, offset: 5, sosf : 1, eof : 1, owner : 1;
+  volatile uint8_t *buf;
+  union
+  {
+    struct
+    {
+      struct lldesc_s *stqe_next;
+    }qe;
+    uint32_t empty;
+  };
+}lldesc_t;
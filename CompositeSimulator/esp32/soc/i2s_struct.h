@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+
+//only the I2S0 registers CompositeOutput touches. the descriptor address is kept at full pointer width
+typedef struct
+{
+  union { struct { uint32_t tx_reset:1, rx_reset:1, tx_fifo_reset:1, rx_fifo_reset:1, tx_start:1, rx_start:1, tx_slave_mod:1, rx_slave_mod:1, tx_right_first:1, rx_right_first:1, tx_msb_shift:1, rx_msb_shift:1, tx_short_sync:1, rx_short_sync:1, tx_mono:1, rx_mono:1, tx_msb_right:1, rx_msb_right:1, sig_loopback:1, reserved:13; }; uint32_t val; } conf;
+  union { struct { uint32_t out_done:1, out_eof:1, reserved:30; }; uint32_t val; } int_raw, int_st, int_ena, int_clr;
+  union { struct { uint32_t rx_data_num:6, tx_data_num:6, dscr_en:1, tx_fifo_mod:3, rx_fifo_mod:3, tx_fifo_mod_force_en:1, rx_fifo_mod_force_en:1, reserved:11; }; uint32_t val; } fifo_conf;
+  union { struct { uint32_t tx_chan_mod:3, rx_chan_mod:2, reserved:27; }; uint32_t val; } conf_chan;
+  union { struct { uint32_t camera_en:1, lcd_tx_wrx2_en:1, lcd_tx_sdx2_en:1, data_enable_test_en:1, data_enable:1, lcd_en:1, ext_adc_start_en:1, inter_valid_en:1, reserved:24; }; uint32_t val; } conf2;
+  union { struct { uint32_t clkm_div_num:8, clkm_div_b:6, clkm_div_a:6, clk_en:1, clka_en:1, reserved:10; }; uint32_t val; } clkm_conf;
+  union { struct { uint32_t tx_bck_div_num:6, rx_bck_div_num:6, tx_bits_mod:6, rx_bits_mod:6, reserved:8; }; uint32_t val; } sample_rate_conf;
+  struct { uintptr_t addr; uint32_t stop, start, restart, park; } out_link;
+  union { struct { uint32_t in_rst:1, out_rst:1, ahbm_fifo_rst:1, ahbm_rst:1, out_loop_test:1, in_loop_test:1, out_auto_wrback:1, out_no_restart_clr:1, out_eof_mode:1, outdscr_burst_en:1, indscr_burst_en:1, out_data_burst_en:1, check_owner:1, mem_trans_en:1, reserved:18; }; uint32_t val; } lc_conf;
+  uintptr_t out_eof_des_addr;
+}i2s_dev_t;
+
+static i2s_dev_t I2S0;
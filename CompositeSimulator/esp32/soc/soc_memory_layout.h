@@ -0,0 +1,5 @@
+#pragma once
+#include "Arduino.h"
+
+//internal RAM is everything the simulator didn't allocate as external RAM
+inline bool esp_ptr_dma_capable(const void *p) { return !simulator::external(p); }
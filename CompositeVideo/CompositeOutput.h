@@ -1,5 +1,22 @@
 #pragma once
 #include "driver/i2s.h"
+#include "driver/dac.h"
+#include "driver/periph_ctrl.h"
+#include "soc/i2s_struct.h"
+#include "soc/soc_memory_layout.h"
+#include "rom/lldesc.h"
+#include "esp_intr_alloc.h"
+#include "esp_heap_caps.h"
+#include "TileMap.h"
+#include "Sprite.h"
+#include "PixelFormat.h"
+#include "CompositeAudio.h"
+#include "CopperList.h"
+
+//line timing histograms, output load and blocked time. define as 0 before including to compile them out
+#ifndef COMPOSITE_STATISTICS
+#define COMPOSITE_STATISTICS 1
+#endif
 
 typedef struct
 {
@@ -99,32 +116,239 @@ class CompositeOutput
     
   unsigned short *line;
 
+  //all lines that never carry picture content are built once in init() and sent as they are
+  enum LineTemplate
+  {
+    LINE_BLANK,
+    LINE_LONG_LONG,
+    LINE_LONG_SHORT,
+    LINE_SHORT_SHORT,
+    LINE_SHORT_LONG,
+    LINE_SHORT_BLANK,
+    LINE_BLANK_SHORT,
+    LINE_TEMPLATE_COUNT
+  };
+  unsigned short *lineTemplates[LINE_TEMPLATE_COUNT];
+
+  //sequence of all lines of a frame. values >= 0 are interlaced picture rows (2 * row + field),
+  //negative values are -1 - LineTemplate
+  short *lineProgram;
+  int frameLines;
+
+  int samplesActiveStart;
+  //framebuffer byte to the pair of samples it is sent as, level shifted and already in DMA byte order
+  unsigned int pixelWords[256];
+  //PIXELS_GRAY4: gray value of each nibble and the samples of the two pixels of a byte,
+  //as two words in half resolution and as a single word in full resolution
+  char nibbleGrays[16];
+  unsigned int nibblePairWords[256][2];
+  unsigned int nibbleWords[256];
+  //PIXELS_MONO: gray values of clear and set bits and the samples of the eight pixels of a byte,
+  //8 words in half resolution and 4 in full resolution. the table is only allocated once a mono frame is set
+  char monoGrays[2];
+  unsigned int *monoWords;
+  int monoWordsResolution;
+  //samples written by the encoder during the last frame (the old per-line rebuild wrote samplesLine * frameLines)
+  int samplesEncoded;
+  int samplesEncodedFrame;
+
   static const i2s_port_t I2S_PORT = (i2s_port_t)I2S_NUM_0;
+
+  enum Backend
+  {
+    I2S_DRIVER,   //lines are copied into the buffers of the i2s driver
+    DMA_RING,     //DMA reads the lines straight from a ring of descriptors
+    DMA_INTERRUPT //like DMA_RING, but the lines are encoded in the DMA interrupt a few lines ahead of the beam
+  };
+  Backend backend;
+
+  //each line of the ring is chained from three descriptors: sync and left porch, active part and right porch.
+  //the outer two always point into a template, the active part points to the ring's own buffer for picture lines
+  static const int dmaRingLines = 8;
+  lldesc_t *dmaDescriptors;
+  unsigned short *dmaActive[dmaRingLines];
+  intr_handle_t dmaInterrupt;
+  TaskHandle_t dmaTask;
+  //lines the DMA finished, each one frees its slot in the ring for a refill
+  volatile unsigned int dmaLinesDone;
+  unsigned int dmaLinesQueued;
+  //lines that were queued after the DMA already passed their slot, only the DMA backends can count them
+  int lateLines;
+
+  //with audio the i2s runs in stereo: video goes to DAC1 (GPIO25) and the audio to DAC2 (GPIO26).
+  //every sample becomes a 32 bit frame of both channels, the lines are interleaved into buffers of their own
+  AudioBuffer *audio;
+  unsigned int *stereoLine;
+  unsigned int *dmaStereo[dmaRingLines];
+  //the audio sample is held for several DAC samples. the phase counts in 1/3 Hz so the 13.333MHz stay exact
+  static const unsigned int audioWrap = 40000000;
+  unsigned int audioStep;
+  unsigned int audioPhase;
+  unsigned int audioSample;
+
+  //frame shown in interrupt mode and the next line of the program to be encoded
+  char ***frame;
+  bool fullResolution;
+  PixelFormat frameFormat;
+
+  //renders the pixels of row y just in time instead of reading them from a frame.
+  //y and the pixel count are the same as for the frame it replaces
+  typedef void (*ScanlineRenderer)(int y, char *pixels);
+  ScanlineRenderer scanlineRenderer;
+  char *scanlinePixels;
+  //character cells expanded at scanout, a screen of text only needs columns * rows bytes
+  TileMap *tileMap;
+
+  //sprites drawn over every picture line. the number per line is limited to keep the line time bounded,
+  //the ones with the highest priority win
+  static const int maxSprites = 32;
+  static const int maxSpritesPerLine = 8;
+  Sprite *sprites;
+  int spriteCount;
+  //sprites sorted by descending priority, updated every frame
+  Sprite *spriteOrder[maxSprites];
+  //sprites dropped from a line because there were more than maxSpritesPerLine
+  int spriteOverflows;
+
+#if COMPOSITE_STATISTICS
+  //encoding time of each line type (LineTemplate, last one for picture lines) in eighths of a line.
+  //the last bin counts the lines that took a whole line or longer
+  static const int statisticsBins = 9;
+  unsigned int lineHistogram[LINE_TEMPLATE_COUNT + 1][statisticsBins];
+  //time spent waiting for the output to take a line
+  unsigned int blockedCycles;
+  //blocked time of the last frame in percent
+  int blockedLoad;
+  //the most sprites drawSprites drew on a line and the most sprite pixels it went through on a line
+  int spritesLineMax;
+  int spritePixelsLineMax;
+#endif
+
+  //encoded picture lines kept for frame rows that didn't change.
+  //the versions tell if a row changed, rows with the same version in any frame have the same pixels
+  typedef const unsigned int *(*RowVersions)(char **rows);
+  RowVersions rowVersions;
+  int lineCacheLines;
+  int lineCacheUsed;
+  unsigned short *lineCache;
+  //cache line of each frame row, -1 if it has none, and the row version it was last encoded with
+  short *lineCacheSlots;
+  unsigned int *lineCacheVersions;
+  //picture lines taken from the cache during the last frame
+  int lineCacheHits;
+  int lineCacheHitsFrame;
+
+  //per row raster effects, picture lines with a palette or an offset bypass the line cache and zero-copy samples
+  CopperList *copper;
+  //the screen shows the frame from this pixel and row on. setScroll takes effect at the next vertical blank
+  int scrollX, scrollY;
+  volatile int nextScrollX, nextScrollY;
+  volatile bool scrollPending;
+  //size of a frame larger than the screen in pixels and rows, 0 if it's the size of the screen
+  int playfieldWidth, playfieldHeight;
+
+  //rows of frames in external RAM are copied into a ring of internal RAM a few lines before they're encoded,
+  //so the encoder doesn't wait for the PSRAM. the slot of a picture line is its program line modulo the ring size.
+  //a slot is only used if it was filled for the same line, row and frame
+  int prefetchLines;
+  int prefetchRowBytes;
+  char *prefetchRing;
+  short *prefetchTags;
+  short *prefetchSources;
+  char ***prefetchFrames;
+  //lines after the current one that are prefetched already
+  int prefetchDone;
+  //time per line the prefetch may take, the row of the next line is copied anyway
+  unsigned int prefetchBudget;
+  //rows that weren't prefetched in time and had to be read from the frame
+  int prefetchMisses;
+  int renderingLine;
+
+  //picture lines whose rendering and encoding took longer than a line
+  int scanlineMisses;
+  unsigned int lineCycles;
+  int programLine;
+#if COMPOSITE_STATISTICS
+  //percentage of the cpu time spent generating lines during the last frame
+  int outputLoad;
+  unsigned int outputCycles;
+#endif
+  unsigned int frameStartCycles;
+
+  //program lines right after the last picture line of each field. from there on the frame isn't read until the next field starts
+  int fieldEnds[2];
+  //fields whose picture lines are done, counts up at every vertical blank
+  volatile unsigned int fieldCount;
+  //called at every vertical blank by the task sending the frames or by the interrupt in interrupt mode
+  typedef void (*VBlankCallback)(void *arg);
+  VBlankCallback vblankCallback;
+  void *vblankArg;
+  //buffer swap that is deferred to the next vertical blank
+  char ***volatile swapFront;
+  char ***volatile swapBack;
+  volatile bool swapPending;
+  int swapInterval;
+  unsigned int swapField;
+  //task waiting for the next vertical blank
+  volatile TaskHandle_t vsyncTask;
+
+  //small pieces of work done by the task sending the frames while it would only wait for blank lines to go out.
+  //a job is only started when its budget fits the time left, one that took longer is held back until its longest run fits
+  typedef void (*BlankJob)(void *arg);
+  struct Job
+  {
+    BlankJob function;
+    void *arg;
+    unsigned int budget;
+    unsigned int maxCycles;
+    unsigned int runs;
+    unsigned int overruns;
+  };
+  static const int maxJobs = 8;
+  Job jobs[maxJobs];
+  int nextJob;
+  unsigned int jobEndCycles;
+  //percentage of the cpu time spent in jobs during the last frame
+  int jobLoad;
+  unsigned int jobCycles;
     
   enum Mode
   {
     PAL,
-    NTSC  
+    NTSC,
+    //non-interlaced 288p and 240p, every field shows the same rows
+    PAL_PROGRESSIVE,
+    NTSC_PROGRESSIVE
   };
   
   const TechProperties &properties;
+  bool progressive;
   
   CompositeOutput(Mode mode, int xres, int yres, double Vcc = 3.3)
-    :properties((mode==NTSC) ? NTSCProperties: PALProperties)
+    :properties((mode==NTSC || mode==NTSC_PROGRESSIVE) ? NTSCProperties: PALProperties),
+    progressive(mode==PAL_PROGRESSIVE || mode==NTSC_PROGRESSIVE)
   {    
-    int linesSyncTop = 5;
+    //progressive fields only have the three broad pulse lines for vsync
+    int linesSyncTop = progressive ? 3 : 5;
     int linesSyncBottom = 3;
 
     linesOdd = properties.lines / 2;
-    linesEven = properties.lines - linesOdd;
+    linesEven = progressive ? linesOdd : properties.lines - linesOdd;
     linesEvenActive = linesEven - properties.linesFirstTop - linesSyncBottom;
     linesOddActive = linesOdd - properties.linesFirstTop - linesSyncBottom;
     linesEvenVisible = linesEvenActive - properties.linesOverscanTop - properties.linesOverscanBottom; 
     linesOddVisible = linesOddActive - properties.linesOverscanTop - properties.linesOverscanBottom;
 
-    targetYresOdd = (yres / 2 < linesOddVisible) ? yres / 2 : linesOddVisible;
-    targetYresEven = (yres - targetYresOdd < linesEvenVisible) ? yres - targetYresOdd : linesEvenVisible;
-    targetYres = targetYresEven + targetYresOdd;
+    if(progressive)
+    {
+      targetYres = targetYresEven = targetYresOdd = (yres < linesEvenVisible) ? yres : linesEvenVisible;
+    }
+    else
+    {
+      targetYresOdd = (yres / 2 < linesOddVisible) ? yres / 2 : linesOddVisible;
+      targetYresEven = (yres - targetYresOdd < linesEvenVisible) ? yres - targetYresOdd : linesEvenVisible;
+      targetYres = targetYresEven + targetYresOdd;
+    }
     
     linesEvenBlankTop = properties.linesFirstTop - linesSyncTop + properties.linesOverscanTop + (linesEvenVisible - targetYresEven) / 2;
     linesEvenBlankBottom = linesEven - linesEvenBlankTop - targetYresEven - linesSyncBottom;
@@ -139,11 +363,23 @@ class CompositeOutput
     samplesBack = samplesPerMicro * (properties.backMicros + properties.overscanRightMicros) + 0.5;
     samplesActive = samplesLine - samplesSync - samplesBlank - samplesBack;
 
-    targetXres = xres < samplesActive ? xres : samplesActive;
+    targetXres = (xres < samplesActive ? xres : samplesActive) & ~1;
 
     samplesVSyncShort = samplesPerMicro * properties.shortVSyncMicros + 0.5;
     samplesBlackLeft = (samplesActive - targetXres) / 2;
+    //the active part has to start word aligned for DMA
+    if((samplesSync + samplesBlank + samplesBlackLeft) & 1)
+    {
+      if(samplesBlackLeft)
+        samplesBlackLeft--;
+      else
+      {
+        targetXres -= 2;
+        samplesBlackLeft = 1;
+      }
+    }
     samplesBlackRight = samplesActive - targetXres - samplesBlackLeft;
+    samplesActiveStart = samplesSync + samplesBlank + samplesBlackLeft;
     double dacPerVolt = 255.0 / Vcc;
     levelSync = 0;
     levelBlank = (properties.blankVolts - properties.syncVolts) * dacPerVolt + 0.5;
@@ -151,17 +387,101 @@ class CompositeOutput
     levelWhite = (properties.whiteVolts - properties.syncVolts) * dacPerVolt + 0.5;
     grayValues = levelWhite - levelBlack + 1;
 
-    pixelAspect = (float(samplesActive) / (linesEvenVisible + linesOddVisible)) / properties.imageAspect;
+    pixelAspect = (float(samplesActive) / (progressive ? linesEvenVisible : linesEvenVisible + linesOddVisible)) / properties.imageAspect;
+    samplesEncoded = samplesEncodedFrame = 0;
+    for(int i = 0; i < maxJobs; i++)
+      jobs[i].function = 0;
+    nextJob = 0;
+    jobLoad = 0;
+    jobCycles = 0;
+    rowVersions = 0;
+    lineCacheLines = lineCacheUsed = 0;
+    lineCache = 0;
+    lineCacheHits = lineCacheHitsFrame = 0;
+    prefetchLines = 0;
+    prefetchRing = 0;
+    prefetchDone = 0;
+    for(int i = 0; i < 256; i++)
+    {
+      unsigned short pix = (levelBlack + (char)i) << 8;
+      pixelWords[i] = pix | (pix << 16);
+    }
+    monoGrays[0] = 0;
+    monoGrays[1] = grayValues - 1;
+    monoWords = 0;
+    monoWordsResolution = -1;
+    for(int n = 0; n < 16; n++)
+      nibbleGrays[n] = n * 4 < grayValues ? n * 4 : grayValues - 1;
+    for(int i = 0; i < 256; i++)
+    {
+      nibblePairWords[i][0] = pixelWords[(unsigned char)nibbleGrays[i & 15]];
+      nibblePairWords[i][1] = pixelWords[(unsigned char)nibbleGrays[i >> 4]];
+      nibbleWords[i] = (nibblePairWords[i][0] & 0xffff0000) | (nibblePairWords[i][1] & 0xffff);
+    }
+  }
+
+  //passing an audio buffer turns on the audio output on the second DAC
+  void init(Backend backend = I2S_DRIVER, AudioBuffer *audio = 0)
+  {
+    this->backend = backend;
+    this->audio = audio;
+    if(audio)
+    {
+      audioStep = audio->sampleRate * 3;
+      audioPhase = 0;
+      audioSample = 128 << 8;
+    }
+    frame = 0;
+    fullResolution = false;
+    frameFormat = PIXELS_GRAY8;
+    scanlineRenderer = 0;
+    tileMap = 0;
+    copper = 0;
+    scrollX = scrollY = 0;
+    scrollPending = false;
+    playfieldWidth = playfieldHeight = 0;
+    sprites = 0;
+    spriteCount = 0;
+    scanlinePixels = (char*)malloc(targetXres);
+    lineCycles = properties.lineMicros * ESP.getCpuFreqMHz();
+    resetStatistics();
+    programLine = 0;
+#if COMPOSITE_STATISTICS
+    outputLoad = 0;
+    outputCycles = 0;
+#endif
+    frameStartCycles = ESP.getCycleCount();
+    fieldCount = 0;
+    vblankCallback = 0;
+    vblankArg = 0;
+    swapPending = false;
+    swapInterval = 1;
+    swapField = 0;
+    vsyncTask = 0;
+    initLineTemplates();
+    initLineProgram();
+    //the DMA still reads the lines in the ring, frame rows might be among them
+    if(backend != I2S_DRIVER)
+      for(int i = 0; i < 2; i++)
+        fieldEnds[i] += dmaRingLines;
+    if(backend != I2S_DRIVER)
+      initDMA();
+    else
+      initDriver();
   }
 
-  void init()
+  void initDriver()
   {
+    //picture lines only get their active part encoded, sync and porches stay from the blank line
     line = (unsigned short*)malloc(sizeof(unsigned short) * samplesLine);
+    memcpy(line, lineTemplates[LINE_BLANK], sizeof(unsigned short) * samplesLine);
+    if(audio)
+      stereoLine = (unsigned int*)malloc(sizeof(unsigned int) * samplesLine);
     i2s_config_t i2s_config = {
        .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX | I2S_MODE_DAC_BUILT_IN),
        .sample_rate = 1000000,  //not really used
        .bits_per_sample = (i2s_bits_per_sample_t)I2S_BITS_PER_SAMPLE_16BIT, 
-       .channel_format = I2S_CHANNEL_FMT_ONLY_RIGHT,
+       .channel_format = audio ? I2S_CHANNEL_FMT_RIGHT_LEFT : I2S_CHANNEL_FMT_ONLY_RIGHT,
        .communication_format = I2S_COMM_FORMAT_I2S_MSB,
        .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
        .dma_buf_count = 2,
@@ -179,130 +499,1250 @@ class CompositeOutput
     SET_PERI_REG_BITS(I2S_SAMPLE_RATE_CONF_REG(I2S_PORT), I2S_TX_BCK_DIV_NUM_V, 2, I2S_TX_BCK_DIV_NUM_S);
   }
 
-  void sendLine()
+  void initDMA()
+  {
+    dmaDescriptors = (lldesc_t*)heap_caps_calloc(dmaRingLines * 3, sizeof(lldesc_t), MALLOC_CAP_DMA);
+    int lengths[3] = {samplesActiveStart, targetXres, samplesLine - samplesActiveStart - targetXres};
+    //stereo lines are interleaved into a buffer of their own, the descriptors stay pointing to its three parts
+    int sampleBytes = audio ? sizeof(unsigned int) : sizeof(unsigned short);
+    for(int l = 0; l < dmaRingLines; l++)
+    {
+      dmaActive[l] = (unsigned short*)heap_caps_malloc(sizeof(unsigned short) * targetXres, MALLOC_CAP_DMA);
+      if(audio)
+        dmaStereo[l] = (unsigned int*)heap_caps_malloc(sizeof(unsigned int) * samplesLine, MALLOC_CAP_DMA);
+      for(int j = 0, offset = 0; j < 3; offset += lengths[j++])
+      {
+        lldesc_t &d = dmaDescriptors[l * 3 + j];
+        d.size = d.length = lengths[j] * sampleBytes;
+        if(audio)
+          d.buf = (uint8_t*)(dmaStereo[l] + offset);
+        d.owner = 1;
+        d.eof = j == 2;
+        d.qe.stqe_next = &dmaDescriptors[(l * 3 + j + 1) % (dmaRingLines * 3)];
+      }
+      setDMALine(l, lineTemplates[LINE_BLANK], lineTemplates[LINE_BLANK] + samplesActiveStart);
+    }
+    //the DMA starts on line 0 and might already have fetched line 1
+    dmaLinesDone = 0;
+    dmaLinesQueued = 2;
+    dmaTask = 0;
+    //in interrupt mode the ring is kept full from the start
+    if(backend == DMA_INTERRUPT)
+      while(dmaLinesQueued < dmaRingLines)
+        queueLine(dmaActive[dmaLinesQueued % dmaRingLines]);
+
+    periph_module_enable(PERIPH_I2S0_MODULE);
+    //not an IRAM interrupt, the encoder and the frame data are not guaranteed to be there
+    esp_intr_alloc(ETS_I2S0_INTR_SOURCE, ESP_INTR_FLAG_LEVEL1, dmaInterruptHandler, this, &dmaInterrupt);
+    //same configuration the driver sets for the built in DAC with 16 bit right channel only
+    I2S0.conf.val = 1;
+    I2S0.conf.val = 0;
+    I2S0.conf.tx_right_first = 1;
+    I2S0.conf.tx_mono = audio ? 0 : 1;
+    I2S0.conf2.lcd_en = 1;
+    I2S0.fifo_conf.tx_fifo_mod_force_en = 1;
+    //16 bit dual channel fifo with audio, 16 bit single channel without
+    I2S0.fifo_conf.tx_fifo_mod = audio ? 0 : 1;
+    I2S0.fifo_conf.dscr_en = 1;
+    I2S0.conf_chan.tx_chan_mod = audio ? 0 : 1;
+    I2S0.sample_rate_conf.tx_bits_mod = 16;
+    //the same 13.333MHz clock hack as with the driver
+    I2S0.clkm_conf.clka_en = 0;
+    I2S0.clkm_conf.clkm_div_a = 1;
+    I2S0.clkm_conf.clkm_div_b = 1;
+    I2S0.clkm_conf.clkm_div_num = 2;
+    I2S0.sample_rate_conf.tx_bck_div_num = 2;
+
+    I2S0.lc_conf.out_rst = 1;
+    I2S0.lc_conf.out_rst = 0;
+    I2S0.out_link.addr = (uintptr_t)dmaDescriptors;
+    I2S0.int_clr.val = 0xffffffff;
+    I2S0.int_ena.out_eof = 1;
+    I2S0.out_link.start = 1;
+    I2S0.conf.tx_start = 1;
+    esp_intr_enable(dmaInterrupt);
+
+    dac_output_enable(DAC_CHANNEL_1);
+    if(audio)
+      dac_output_enable(DAC_CHANNEL_2);
+    dac_i2s_enable();
+  }
+
+  static void dmaInterruptHandler(void *arg)
+  {
+    //only out_eof is enabled. it's cleared before the refill, so a line finished meanwhile raises the interrupt again
+    uint32_t status = I2S0.int_st.val;
+    I2S0.int_clr.val = status;
+    if(status)
+      ((CompositeOutput*)arg)->lineDone();
+  }
+
+  //called from the interrupt when the DMA finished a line, its slot is free to be refilled now.
+  //the descriptor of the last finished line tells how far the DMA got, it might have finished several
+  //lines while the interrupt was held off
+  void lineDone()
+  {
+#if COMPOSITE_STATISTICS
+    unsigned int t = ESP.getCycleCount();
+#endif
+    int slot = ((lldesc_t*)(uintptr_t)I2S0.out_eof_des_addr - dmaDescriptors) / 3;
+    dmaLinesDone += (slot + 1 - (int)(dmaLinesDone % dmaRingLines) + dmaRingLines) % dmaRingLines;
+    if(backend == DMA_INTERRUPT)
+    {
+      while((int)(dmaLinesQueued - dmaLinesDone) < dmaRingLines)
+        queueLine(dmaActive[dmaLinesQueued % dmaRingLines]);
+#if COMPOSITE_STATISTICS
+      outputCycles += ESP.getCycleCount() - t;
+#endif
+      return;
+    }
+    if(dmaTask)
+    {
+      BaseType_t woken = pdFALSE;
+      vTaskNotifyGiveFromISR(dmaTask, &woken);
+      if(woken)
+        portYIELD_FROM_ISR();
+    }
+  }
+
+  inline unsigned int nextAudioSample()
+  {
+    audioPhase += audioStep;
+    if(audioPhase >= audioWrap)
+    {
+      audioPhase -= audioWrap;
+      int sample = audio->read();
+      if(sample >= 0)
+        audioSample = sample << 8;
+    }
+    return audioSample;
+  }
+
+  //count mono samples (even) become stereo frames, the video sample in the upper half that is sent first
+  inline void interleaveSamples(unsigned int *stereo, int &i, const unsigned short *mono, int count)
+  {
+    const unsigned int *words = (const unsigned int*)mono;
+    for(int j = 0; j < count / 2; j++)
+    {
+      unsigned int w = words[j];
+      stereo[i++] = (w & 0xffff0000) | nextAudioSample();
+      stereo[i++] = (w << 16) | nextAudioSample();
+    }
+  }
+
+  void interleaveLine(unsigned int *stereo, const unsigned short *base, const unsigned short *active)
+  {
+    int i = 0;
+    interleaveSamples(stereo, i, base, samplesActiveStart);
+    interleaveSamples(stereo, i, active, targetXres);
+    interleaveSamples(stereo, i, base + samplesActiveStart + targetXres, samplesLine - samplesActiveStart - targetXres);
+  }
+
+  void setDMALine(int slot, const unsigned short *base, const unsigned short *active)
   {
+    if(audio)
+    {
+      interleaveLine(dmaStereo[slot], base, active);
+      return;
+    }
+    lldesc_t *d = &dmaDescriptors[slot * 3];
+    d[0].buf = (uint8_t*)base;
+    d[1].buf = (uint8_t*)active;
+    d[2].buf = (uint8_t*)(base + samplesActiveStart + targetXres);
+  }
+
+  //returns the buffer the active part of the next line can be encoded to
+  unsigned short *acquireLine()
+  {
+    if(backend == I2S_DRIVER)
+      return line + samplesActiveStart;
+    dmaTask = xTaskGetCurrentTaskHandle();
+#if COMPOSITE_STATISTICS
+    unsigned int t = ESP.getCycleCount();
+#endif
+    //the slot is free when the DMA finished the line that was queued there one turn before
+    while((int)(dmaLinesQueued - dmaLinesDone) > dmaRingLines - 1)
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#if COMPOSITE_STATISTICS
+    blockedCycles += ESP.getCycleCount() - t;
+#endif
+    return dmaActive[dmaLinesQueued % dmaRingLines];
+  }
+
+  //sends a line made of the sync and porches of base and the given active part
+  void sendLine(const unsigned short *base, const unsigned short *active)
+  {
+    if(backend != I2S_DRIVER)
+    {
+      if((int)(dmaLinesQueued - dmaLinesDone) < 2)
+        lateLines++;
+      setDMALine(dmaLinesQueued % dmaRingLines, base, active);
+      dmaLinesQueued++;
+      return;
+    }
+    const unsigned short *samples = (active == base + samplesActiveStart) ? base : line;
+    size_t bytes_to_write = samplesLine * sizeof(unsigned short);
+    if(audio)
+    {
+      interleaveLine(stereoLine, base, active);
+      samples = (const unsigned short*)stereoLine;
+      bytes_to_write = samplesLine * sizeof(unsigned int);
+    }
     esp_err_t error = ESP_OK;
     size_t bytes_written = 0;
-    size_t bytes_to_write = samplesLine * sizeof(unsigned short);
     size_t cursor = 0;
     while (error == ESP_OK && bytes_to_write > 0) {
-      error = i2s_write(I2S_PORT, (const char *)line + cursor, bytes_to_write, &bytes_written, portMAX_DELAY);
+      error = i2s_write(I2S_PORT, (const char *)samples + cursor, bytes_to_write, &bytes_written, portMAX_DELAY);
       bytes_to_write -= bytes_written;
       cursor += bytes_written;
     }
   }
 
-  inline void fillValues(int &i, unsigned char value, int count)
+  inline void fillValues(unsigned short *buffer, int &i, unsigned char value, int count)
   {
     for(int j = 0; j < count; j++)
-      line[i++^1] = value << 8;
+      buffer[i++^1] = value << 8;
   }
 
-  void fillLine(char *pixels)
+  void fillLine(char *pixels, unsigned short *active)
   {
-    int i = 0;
-    fillValues(i, levelSync, samplesSync);
-    fillValues(i, levelBlank, samplesBlank);
-    fillValues(i, levelBlack, samplesBlackLeft);
+    //the active part starts word aligned so each pixel is a single store
+    unsigned int *words = (unsigned int*)active;
     for(int x = 0; x < targetXres / 2; x++)
+      words[x] = pixelWords[(unsigned char)pixels[x]];
+    samplesEncoded += targetXres;
+  }
+
+  //pixel word of a tile map color. there is nothing behind the map, a negative (transparent) color is black
+  inline unsigned int tileColorWord(int color)
+  {
+    if(color < 0)
+      return pixelWords[0];
+    return pixelWords[color < grayValues ? color : grayValues - 1];
+  }
+
+  void fillLineTiles(int row, unsigned short *active)
+  {
+    TileMap &map = *tileMap;
+    int cellRow = row / map.tileYres;
+    int py = row - cellRow * map.tileYres;
+    int pixelCount = fullResolution ? targetXres : targetXres / 2;
+    int width = map.columns * map.tileXres;
+    if(cellRow >= map.rows)
+      width = 0;
+    else if(width > pixelCount)
+      width = pixelCount;
+    unsigned int front = tileColorWord(map.frontColor);
+    unsigned int back = tileColorWord(map.backColor);
+    bool raw = map.frontColor < 0;
+    const char *cells = &map.cells[cellRow * map.columns];
+    unsigned int *words = (unsigned int*)active;
+    int x = 0;
+    while(x < width)
+    {
+      const unsigned char *pix = map.tileRow(*(cells++), py);
+      for(int px = 0; px < map.tileXres && x < width; px++, x++)
+      {
+        unsigned int w = raw ? pixelWords[pix[px]] : (pix[px] ? front : back);
+        if(fullResolution)
+          active[x ^ 1] = w;
+        else
+          words[x] = w;
+      }
+    }
+    for(; x < pixelCount; x++)
+      if(fullResolution)
+        active[x ^ 1] = back;
+      else
+        words[x] = back;
+    samplesEncoded += targetXres;
+  }
+
+  void sortSprites(int count)
+  {
+    for(int i = 0; i < count; i++)
+    {
+      Sprite *s = &sprites[i];
+      int j = i;
+      for(; j > 0 && spriteOrder[j - 1]->priority < s->priority; j--)
+        spriteOrder[j] = spriteOrder[j - 1];
+      spriteOrder[j] = s;
+    }
+  }
+
+  void drawSprites(int row, unsigned short *active)
+  {
+    Sprite *lineSprites[maxSpritesPerLine];
+    int count = 0;
+    for(int i = 0; i < spriteCount; i++)
+    {
+      Sprite *s = spriteOrder[i];
+      if(!s->visible || row < s->y || row >= s->y + s->yres)
+        continue;
+      if(count == maxSpritesPerLine)
+      {
+        spriteOverflows++;
+        continue;
+      }
+      lineSprites[count++] = s;
+    }
+    int pixelCount = fullResolution ? targetXres : targetXres / 2;
+    unsigned int *words = (unsigned int*)active;
+#if COMPOSITE_STATISTICS
+    if(count > spritesLineMax)
+      spritesLineMax = count;
+    int linePixels = 0;
+#endif
+    //lowest priority first so the highest ends up on top
+    while(count)
+    {
+      Sprite &s = *lineSprites[--count];
+      const unsigned char *pix = &s.pixels[(row - s.y) * s.xres];
+      int x0 = s.x < 0 ? 0 : s.x;
+      int x1 = s.x + s.xres > pixelCount ? pixelCount : s.x + s.xres;
+#if COMPOSITE_STATISTICS
+      if(x1 > x0)
+        linePixels += x1 - x0;
+#endif
+      for(int x = x0; x < x1; x++)
+      {
+        int c = pix[x - s.x];
+        if(c == s.transparent)
+          continue;
+        if(fullResolution)
+          active[x ^ 1] = pixelWords[c];
+        else
+          words[x] = pixelWords[c];
+      }
+    }
+#if COMPOSITE_STATISTICS
+    if(linePixels > spritePixelsLineMax)
+      spritePixelsLineMax = linePixels;
+#endif
+  }
+
+  //PIXELS_GRAY4, a table lookup for every byte of two pixels
+  void fillLineNibbles(char *pixels, unsigned short *active)
+  {
+    unsigned int *words = (unsigned int*)active;
+    if(fullResolution)
+      for(int x = 0; x < targetXres / 2; x++)
+        words[x] = nibbleWords[(unsigned char)pixels[x]];
+    else
+    {
+      for(int x = 0; x < targetXres / 4; x++)
+      {
+        const unsigned int *pair = nibblePairWords[(unsigned char)pixels[x]];
+        words[x * 2] = pair[0];
+        words[x * 2 + 1] = pair[1];
+      }
+      if(targetXres & 2)
+        words[targetXres / 2 - 1] = nibblePairWords[(unsigned char)pixels[targetXres / 4]][0];
+    }
+    samplesEncoded += targetXres;
+  }
+
+  //PIXELS_MONO, a table lookup for every byte of eight pixels
+  void fillLineMono(char *pixels, unsigned short *active)
+  {
+    unsigned int *words = (unsigned int*)active;
+    int count = fullResolution ? targetXres : targetXres / 2;
+    int perByte = fullResolution ? 4 : 8;
+    for(int x = 0; x < count / 8; x++)
+    {
+      const unsigned int *w = &monoWords[(unsigned char)pixels[x] * 8];
+      for(int i = 0; i < perByte; i++)
+        words[i] = w[i];
+      words += perByte;
+    }
+    //the pixels of the last byte that are still on the line
+    if(count & 7)
+    {
+      const unsigned int *w = &monoWords[(unsigned char)pixels[count / 8] * 8];
+      for(int i = 0; i < (count & 7) * perByte / 8; i++)
+        words[i] = w[i];
+    }
+    samplesEncoded += targetXres;
+  }
+
+  void initMonoWords(bool fullResolution)
+  {
+    if(!monoWords)
+      monoWords = (unsigned int*)malloc(256 * 8 * sizeof(unsigned int));
+    for(int b = 0; b < 256; b++)
     {
-      short pix = (levelBlack + pixels[x]) << 8;
-      line[i++^1] = pix;
-      line[i++^1]   = pix;
+      unsigned int *w = &monoWords[b * 8];
+      for(int i = 0; i < 8; i++)
+      {
+        unsigned int word = pixelWords[(unsigned char)monoGrays[(b >> i) & 1]];
+        if(!fullResolution)
+          w[i] = word;
+        else if(i & 1)
+          w[i >> 1] |= word & 0xffff;
+        else
+          w[i >> 1] = word & 0xffff0000;
+      }
     }
-    fillValues(i, levelBlack, samplesBlackRight);
-    fillValues(i, levelBlank, samplesBack);
+    monoWordsResolution = fullResolution;
   }
 
-  void fillLong(int &i)
+  //gray values PIXELS_MONO frames are shown in
+  void setMonoColors(int front, int back = 0)
   {
-    fillValues(i, levelSync, samplesLine / 2 - samplesVSyncShort);
-    fillValues(i, levelBlank, samplesVSyncShort);
+    monoGrays[0] = back;
+    monoGrays[1] = front;
+    if(monoWords)
+      initMonoWords(monoWordsResolution);
+    //cached lines were encoded with the old colors and the rows didn't change
+    invalidateLineCache();
+  }
+
+  void fillLineFullResolution(char *pixels, unsigned short *active)
+  {
+    //two pixels per word, the first one goes to the upper half
+    unsigned int *words = (unsigned int*)active;
+    for(int x = 0; x < targetXres / 2; x++)
+      words[x] = (pixelWords[(unsigned char)pixels[x * 2]] & 0xffff0000) | (pixelWords[(unsigned char)pixels[x * 2 + 1]] & 0xffff);
+    samplesEncoded += targetXres;
+  }
+
+  void fillLong(unsigned short *buffer, int &i)
+  {
+    fillValues(buffer, i, levelSync, samplesLine / 2 - samplesVSyncShort);
+    fillValues(buffer, i, levelBlank, samplesVSyncShort);
   }
   
-  void fillShort(int &i)
+  void fillShort(unsigned short *buffer, int &i)
   {
-    fillValues(i, levelSync, samplesVSyncShort);
-    fillValues(i, levelBlank, samplesLine / 2 - samplesVSyncShort);  
+    fillValues(buffer, i, levelSync, samplesVSyncShort);
+    fillValues(buffer, i, levelBlank, samplesLine / 2 - samplesVSyncShort);  
   }
   
-  void fillBlank()
+  void fillBlank(unsigned short *buffer)
   {
     int i = 0;
-    fillValues(i, levelSync, samplesSync);
-    fillValues(i, levelBlank, samplesBlank);
-    fillValues(i, levelBlack, samplesActive);
-    fillValues(i, levelBlank, samplesBack);
+    fillValues(buffer, i, levelSync, samplesSync);
+    fillValues(buffer, i, levelBlank, samplesBlank);
+    fillValues(buffer, i, levelBlack, samplesActive);
+    fillValues(buffer, i, levelBlank, samplesBack);
   }
 
-  void fillHalfBlank()
+  void fillHalfBlank(unsigned short *buffer, int &i)
   {
-    int i = 0;
-    fillValues(i, levelSync, samplesSync);
-    fillValues(i, levelBlank, samplesLine / 2 - samplesSync);  
+    fillValues(buffer, i, levelSync, samplesSync);
+    fillValues(buffer, i, levelBlank, samplesLine / 2 - samplesSync);  
   }
-  
-  void sendFrameHalfResolution(char ***frame)
+
+  void initLineTemplates()
   {
-    //Even Halfframe    
-    int i = 0;
-    fillLong(i); fillLong(i);
-    sendLine(); sendLine();
-    i = 0;
-    fillLong(i); fillShort(i);
-    sendLine();
-    i = 0;
-    fillShort(i); fillShort(i);
-    sendLine(); sendLine();
-    fillBlank();
-    for(int y = 0; y < linesEvenBlankTop; y++)
-      sendLine();
-    for(int y = 0; y < targetYresEven; y++)
-    {
-      char *pixels = (*frame)[y];
-      fillLine(pixels);
-      sendLine();
-    }
-    fillBlank();
-    for(int y = 0; y < linesEvenBlankBottom; y++)
-      sendLine();
-    i = 0;
-    fillShort(i); fillShort(i);
-    sendLine(); sendLine();
-    i = 0;
-    fillShort(i); 
+    for(int t = 0; t < LINE_TEMPLATE_COUNT; t++)
+      lineTemplates[t] = (unsigned short*)heap_caps_malloc(sizeof(unsigned short) * samplesLine, MALLOC_CAP_DMA);
+    int i;
+    fillBlank(lineTemplates[LINE_BLANK]);
+    i = 0; fillLong(lineTemplates[LINE_LONG_LONG], i); fillLong(lineTemplates[LINE_LONG_LONG], i);
+    i = 0; fillLong(lineTemplates[LINE_LONG_SHORT], i); fillShort(lineTemplates[LINE_LONG_SHORT], i);
+    i = 0; fillShort(lineTemplates[LINE_SHORT_SHORT], i); fillShort(lineTemplates[LINE_SHORT_SHORT], i);
+    i = 0; fillShort(lineTemplates[LINE_SHORT_LONG], i); fillLong(lineTemplates[LINE_SHORT_LONG], i);
+    i = 0; fillShort(lineTemplates[LINE_SHORT_BLANK], i); fillValues(lineTemplates[LINE_SHORT_BLANK], i, levelBlank, samplesLine / 2);
+    i = 0; fillHalfBlank(lineTemplates[LINE_BLANK_SHORT], i); fillShort(lineTemplates[LINE_BLANK_SHORT], i);
+  }
+
+  void addLines(int &l, LineTemplate lineTemplate, int count = 1)
+  {
+    for(int j = 0; j < count; j++)
+      lineProgram[l++] = -1 - lineTemplate;
+  }
+
+  void addPictureLines(int &l, int count, int field)
+  {
+    for(int y = 0; y < count; y++)
+      lineProgram[l++] = y * 2 + field;
+  }
+
+  void initLineProgram()
+  {
+    if(progressive)
+    {
+      //two identical fields without half lines, both show all rows
+      frameLines = linesEven + linesOdd;
+      lineProgram = (short*)malloc(sizeof(short) * frameLines);
+      int l = 0;
+      for(int field = 0; field < 2; field++)
+      {
+        addLines(l, LINE_LONG_LONG, 3);
+        addLines(l, LINE_BLANK, linesEvenBlankTop);
+        addPictureLines(l, targetYresEven, 0);
+        fieldEnds[field] = l;
+        addLines(l, LINE_BLANK, linesEvenBlankBottom);
+      }
+      return;
+    }
+    frameLines = linesEven + 4 + linesOdd + 6;
+    lineProgram = (short*)malloc(sizeof(short) * frameLines);
+    int l = 0;
+    //even half frame
+    addLines(l, LINE_LONG_LONG, 2);
+    addLines(l, LINE_LONG_SHORT);
+    addLines(l, LINE_SHORT_SHORT, 2);
+    addLines(l, LINE_BLANK, linesEvenBlankTop);
+    addPictureLines(l, targetYresEven, 0);
+    fieldEnds[0] = l;
+    addLines(l, LINE_BLANK, linesEvenBlankBottom);
+    addLines(l, LINE_SHORT_SHORT, 2);
     //odd half frame
-    fillLong(i);
-    sendLine(); 
-    i = 0;
-    fillLong(i); fillLong(i);
-    sendLine(); sendLine();
-    i = 0;
-    fillShort(i); fillShort(i);
-    sendLine(); sendLine();
-    i = 0;
-    fillShort(i); fillValues(i, levelBlank, samplesLine / 2);
-    sendLine();
-
-    fillBlank();
-    for(int y = 0; y < linesOddBlankTop; y++)
-      sendLine();
-    for(int y = 0; y < targetYresOdd; y++)
-    {
-      char *pixels = (*frame)[y];
-      fillLine(pixels);
-      sendLine();
-    }
-    fillBlank();
-    for(int y = 0; y < linesOddBlankBottom; y++)
-      sendLine();
-    i = 0;
-    fillHalfBlank(); fillShort(i);
-    sendLine(); 
-    i = 0;
-    fillShort(i); fillShort(i);
-    sendLine(); sendLine();
+    addLines(l, LINE_SHORT_LONG);
+    addLines(l, LINE_LONG_LONG, 2);
+    addLines(l, LINE_SHORT_SHORT, 2);
+    addLines(l, LINE_SHORT_BLANK);
+    addLines(l, LINE_BLANK, linesOddBlankTop);
+    addPictureLines(l, targetYresOdd, 1);
+    fieldEnds[1] = l;
+    addLines(l, LINE_BLANK, linesOddBlankBottom);
+    addLines(l, LINE_BLANK_SHORT);
+    addLines(l, LINE_SHORT_SHORT, 2);
+  }
+  
+  //encodes the next line of the program into active unless it's a template line.
+  //returns the template the line is based on and points active to the part to be sent
+  const unsigned short *renderLine(unsigned short *&active)
+  {
+    unsigned int lineStart = ESP.getCycleCount();
+    if(programLine == fieldEnds[0] || programLine == fieldEnds[1])
+      vblank();
+    int y = lineProgram[programLine];
+    renderingLine = programLine;
+    if(prefetchDone)
+      prefetchDone--;
+    if(++programLine == frameLines)
+    {
+      programLine = 0;
+      sortSprites(spriteCount);
+      samplesEncodedFrame = samplesEncoded;
+      samplesEncoded = 0;
+      lineCacheHitsFrame = lineCacheHits;
+      lineCacheHits = 0;
+      //integer math only, this runs in the interrupt in interrupt mode and the FPU can't be used there
+      unsigned int now = ESP.getCycleCount();
+      unsigned int percent = (now - frameStartCycles) / 100 + 1;
+      jobLoad = jobCycles / percent;
+      jobCycles = 0;
+#if COMPOSITE_STATISTICS
+      outputLoad = outputCycles / percent;
+      outputCycles = 0;
+      blockedLoad = blockedCycles / percent;
+      blockedCycles = 0;
+#endif
+      frameStartCycles = now;
+    }
+    if(y < 0 || !(frame || scanlineRenderer || tileMap))
+    {
+      const unsigned short *base = lineTemplates[y < 0 ? -1 - y : LINE_BLANK];
+      active = (unsigned short*)base + samplesActiveStart;
+      if(prefetchLines)
+        prefetch(lineStart);
+      return base;
+    }
+    int row = (fullResolution && !progressive) ? y : y >> 1;
+    if(tileMap)
+    {
+      fillLineTiles(row, active);
+      if(spriteCount)
+        drawSprites(row, active);
+      return lineTemplates[LINE_BLANK];
+    }
+    const CopperList::Line *effect = copper ? copper->line(row) : 0;
+    int source = sourceRow(row, effect);
+    int offset = scrollX + (effect ? effect->offset : 0);
+    //only palettes and offsets need the effect encoder. a row command just picks the source row,
+    //that row still comes from the line cache or is sent zero-copy like any other
+    if(offset || (effect && effect->palette))
+      renderEffectLine(source, effect ? effect->palette : 0, offset, active);
+    else if(frame && frameFormat == PIXELS_SAMPLES)
+      renderSampleLine(source, active);
+    else if(frame && lineCacheLines && source < targetYres)
+      renderCachedLine(source, active);
+    else if(scanlineRenderer)
+    {
+      scanlineRenderer(source, scanlinePixels);
+      encodeRow(scanlinePixels, active);
+    }
+    else
+      encodeRow(frameRow(source), active);
+    if(spriteCount)
+      drawSprites(row, active);
+    if(prefetchLines)
+      prefetch(lineStart);
+    if(ESP.getCycleCount() - lineStart > lineCycles)
+      scanlineMisses++;
+    return lineTemplates[LINE_BLANK];
+  }
+
+  //the frame row shown on the line of the given row: the copper list can pick another one and the scroll position moves all of them
+  inline int sourceRow(int row, const CopperList::Line *effect)
+  {
+    int rows = playfieldRows();
+    int source = (effect && effect->row >= 0 && effect->row < rows) ? effect->row : row;
+    if(scrollY)
+    {
+      source = (source + scrollY) % rows;
+      if(source < 0)
+        source += rows;
+    }
+    return source;
+  }
+
+  //row of the frame for the line being rendered, the prefetched copy if there is one
+  inline char *frameRow(int row)
+  {
+    if(prefetchLines)
+    {
+      int slot = renderingLine % prefetchLines;
+      if(prefetchTags[slot] == renderingLine && prefetchSources[slot] == row && prefetchFrames[slot] == *frame)
+        return prefetchRing + slot * prefetchRowBytes;
+      prefetchMisses++;
+    }
+    return (*frame)[row];
+  }
+
+  //bytes of a frame row in the frame's format
+  int frameRowBytes()
+  {
+    int count = fullResolution ? targetXres : targetXres / 2;
+    int width = playfieldWidth > count ? playfieldWidth : count;
+    if(frameFormat == PIXELS_GRAY4)
+      return (width + 1) / 2;
+    if(frameFormat == PIXELS_MONO)
+      return (width + 7) / 8;
+    if(frameFormat == PIXELS_SAMPLES)
+      return width * (fullResolution ? 2 : 4);
+    return width;
+  }
+
+  //copies the rows of the next lines into the ring until it's full or the line's prefetch time is used up.
+  //the next line is always prefetched, a late line doesn't fall further behind by filling the whole ring
+  void prefetch(unsigned int lineStart)
+  {
+    if(!frame || frameRowBytes() > prefetchRowBytes)
+      return;
+    while(prefetchDone < prefetchLines)
+    {
+      if(prefetchDone && ESP.getCycleCount() - lineStart > prefetchBudget)
+        return;
+      int line = programLine + prefetchDone;
+      if(line >= frameLines)
+        line -= frameLines;
+      prefetchDone++;
+      int y = lineProgram[line];
+      if(y < 0)
+        continue;
+      int row = (fullResolution && !progressive) ? y : y >> 1;
+      int source = sourceRow(row, copper ? copper->line(row) : 0);
+      int slot = line % prefetchLines;
+      char **rows = *frame;
+      memcpy(prefetchRing + slot * prefetchRowBytes, rows[source], frameRowBytes());
+      prefetchTags[slot] = line;
+      prefetchSources[slot] = source;
+      prefetchFrames[slot] = rows;
+    }
+  }
+
+  //copies the rows of the given number of lines ahead into internal RAM, for frames in PSRAM. 0 turns it off.
+  //rowBytes is the largest row that can be prefetched, 0 for a row of the screen in any format
+  void setPrefetch(int lines, int rowBytes = 0, unsigned int budgetCycles = 0)
+  {
+    prefetchLines = 0;
+    if(prefetchRing)
+    {
+      heap_caps_free(prefetchRing);
+      free(prefetchTags);
+      free(prefetchSources);
+      free(prefetchFrames);
+      prefetchRing = 0;
+    }
+    if(lines <= 0)
+      return;
+    prefetchRowBytes = rowBytes ? rowBytes : targetXres * sizeof(unsigned short);
+    prefetchRing = (char*)heap_caps_malloc(lines * prefetchRowBytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if(!prefetchRing)
+      return;
+    prefetchTags = (short*)malloc(lines * sizeof(short));
+    prefetchSources = (short*)malloc(lines * sizeof(short));
+    prefetchFrames = (char***)malloc(lines * sizeof(char**));
+    for(int i = 0; i < lines; i++)
+      prefetchTags[i] = -1;
+    prefetchBudget = budgetCycles ? budgetCycles : lineCycles / 2;
+    prefetchMisses = 0;
+    prefetchDone = 0;
+    prefetchLines = lines;
+  }
+
+  inline void encodeRow(char *pixels, unsigned short *active)
+  {
+    if(frameFormat == PIXELS_GRAY4)
+      fillLineNibbles(pixels, active);
+    else if(frameFormat == PIXELS_MONO)
+      fillLineMono(pixels, active);
+    else if(fullResolution)
+      fillLineFullResolution(pixels, active);
+    else
+      fillLine(pixels, active);
+  }
+
+  //rows of the frame, the playfield's or the ones shown on the screen
+  inline int playfieldRows()
+  {
+    if(playfieldHeight && frame)
+      return playfieldHeight;
+    return (fullResolution || progressive) ? targetYres : targetYres / 2;
+  }
+
+  //encodes the row through the palette, starting offset pixels into it. a playfield wraps around at its width,
+  //other frames are black outside. sample frames are only moved, they have no palette
+  void renderEffectLine(int row, const unsigned int *palette, int offset, unsigned short *active)
+  {
+    char *pixels;
+    if(frame)
+      pixels = frameRow(row);
+    else
+    {
+      scanlineRenderer(row, scanlinePixels);
+      pixels = scanlinePixels;
+    }
+    const unsigned int *words = palette ? palette : pixelWords;
+    int count = fullResolution ? targetXres : targetXres / 2;
+    bool wrap = playfieldWidth && frame;
+    int width = wrap ? playfieldWidth : count;
+    int s = offset;
+    if(wrap)
+    {
+      s %= width;
+      if(s < 0)
+        s += width;
+    }
+    int x = 0;
+    while(x < count)
+    {
+      //runs of pixels inside the row and of black outside of it
+      int run = count - x;
+      bool inside = s >= 0 && s < width;
+      if(s < 0 && -s < run)
+        run = -s;
+      if(inside && width - s < run)
+        run = width - s;
+      if(frameFormat == PIXELS_SAMPLES && frame)
+      {
+        if(fullResolution)
+          for(int i = 0; i < run; i++)
+            active[(x + i) ^ 1] = inside ? ((unsigned short*)pixels)[(s + i) ^ 1] : (unsigned short)pixelWords[0];
+        else
+          for(int i = 0; i < run; i++)
+            ((unsigned int*)active)[x + i] = inside ? ((unsigned int*)pixels)[s + i] : pixelWords[0];
+      }
+      else if(frameFormat == PIXELS_GRAY4 || frameFormat == PIXELS_MONO)
+      {
+        for(int i = 0; i < run; i++)
+        {
+          int p = s + i;
+          unsigned int w = pixelWords[0];
+          if(inside && frameFormat == PIXELS_GRAY4)
+            w = words[(unsigned char)nibbleGrays[(pixels[p >> 1] >> ((p & 1) * 4)) & 15]];
+          else if(inside)
+            w = words[(unsigned char)monoGrays[(pixels[p >> 3] >> (p & 7)) & 1]];
+          if(fullResolution)
+            active[(x + i) ^ 1] = w;
+          else
+            ((unsigned int*)active)[x + i] = w;
+        }
+      }
+      else if(fullResolution)
+      {
+        if(inside)
+          for(int i = 0; i < run; i++)
+            active[(x + i) ^ 1] = words[(unsigned char)pixels[s + i]];
+        else
+          for(int i = 0; i < run; i++)
+            active[(x + i) ^ 1] = pixelWords[0];
+      }
+      else
+      {
+        unsigned int *line = (unsigned int*)active + x;
+        if(inside)
+          for(int i = 0; i < run; i++)
+            line[i] = words[(unsigned char)pixels[s + i]];
+        else
+          for(int i = 0; i < run; i++)
+            line[i] = pixelWords[0];
+      }
+      x += run;
+      s += run;
+      if(wrap && s == width)
+        s = 0;
+    }
+    if(frameFormat != PIXELS_SAMPLES || !frame)
+      samplesEncoded += targetXres;
+  }
+
+  //pixel words for a copper list palette, the gray values are scaled by contrast / 256 and brightness is added.
+  //the result is limited to the range from black to white
+  void initPalette(unsigned int *palette, int brightness = 0, int contrast = 256)
+  {
+    for(int i = 0; i < 256; i++)
+    {
+      int v = ((char)i * contrast >> 8) + brightness;
+      if(v < 0) v = 0;
+      if(v > grayValues - 1) v = grayValues - 1;
+      unsigned short pix = (levelBlack + v) << 8;
+      palette[i] = pix | (pix << 16);
+    }
+  }
+
+  //the list's changes are taken over at the vertical blank after its commit(). 0 turns the effects off
+  void setCopperList(CopperList *list)
+  {
+    copper = list;
+  }
+
+  //scrolls without touching the frame, only the rows shown on the lines change. without a playfield the rows wrap
+  //around and the pixels moved in from the sides are black. rows keep their line cache lines when only scrolled vertically
+  void setScroll(int x, int y)
+  {
+    scrollPending = false;
+    nextScrollX = x;
+    nextScrollY = y;
+    scrollPending = true;
+  }
+
+  //frames of the given size in pixels (of the frame's resolution) and rows, the screen shows the part at the scroll position.
+  //the playfield wraps around on both axes, so new rows and columns can be drawn just outside of the shown part
+  void setPlayfield(int width, int height)
+  {
+    playfieldWidth = width;
+    playfieldHeight = height;
+  }
+
+  //the row already is the active part of the line, with DMA it's sent straight from the frame
+  void renderSampleLine(int row, unsigned short *&active)
+  {
+    unsigned short *samples = (unsigned short*)frameRow(row);
+    //the DMA can't read PSRAM, rows there are always copied
+    if(backend != I2S_DRIVER && !spriteCount && !prefetchLines && esp_ptr_dma_capable(samples))
+      active = samples;
+    else
+      memcpy(active, samples, targetXres * sizeof(unsigned short));
+  }
+
+  //rows get a cache line when they were sent twice without a change, as long as there are free ones.
+  //a row keeps its cache line, so with DMA the cached line can be sent as it is
+  void renderCachedLine(int row, unsigned short *&active)
+  {
+    char **rows = *frame;
+    unsigned int version = rowVersions(rows)[row];
+    bool unchanged = lineCacheVersions[row] == version;
+    lineCacheVersions[row] = version;
+    int slot = lineCacheSlots[row];
+    if(slot < 0 && unchanged && lineCacheUsed < lineCacheLines)
+    {
+      slot = lineCacheSlots[row] = lineCacheUsed++;
+      unchanged = false;
+    }
+    if(slot < 0)
+    {
+      encodeRow(frameRow(row), active);
+      return;
+    }
+    unsigned short *cached = lineCache + slot * targetXres;
+    if(unchanged)
+      lineCacheHits++;
+    else
+      encodeRow(frameRow(row), cached);
+    if(backend != I2S_DRIVER && !spriteCount)
+      active = cached;
+    else
+      memcpy(active, cached, targetXres * sizeof(unsigned short));
+  }
+
+  void invalidateLineCache()
+  {
+    if(!lineCacheLines)
+      return;
+    lineCacheUsed = 0;
+    for(int i = 0; i < targetYres; i++)
+    {
+      lineCacheSlots[i] = -1;
+      lineCacheVersions[i] = ~0u;
+    }
+  }
+
+  //keeps up to the given amount of bytes of encoded lines for frame rows that didn't change.
+  //versions gives the row versions of a frame, e.g. CompositeGraphics::rowVersions. 0 bytes turns the cache off
+  void setLineCache(int bytes, RowVersions versions)
+  {
+    int lines = bytes / (targetXres * sizeof(unsigned short));
+    if(lines > targetYres)
+      lines = targetYres;
+    lineCacheLines = 0;
+    if(lineCache)
+    {
+      heap_caps_free(lineCache);
+      free(lineCacheSlots);
+      free(lineCacheVersions);
+      lineCache = 0;
+    }
+    if(lines <= 0)
+      return;
+    lineCache = (unsigned short*)heap_caps_malloc(lines * targetXres * sizeof(unsigned short), MALLOC_CAP_DMA);
+    if(!lineCache)
+      return;
+    lineCacheSlots = (short*)malloc(targetYres * sizeof(short));
+    lineCacheVersions = (unsigned int*)malloc(targetYres * sizeof(unsigned int));
+    rowVersions = versions;
+    lineCacheLines = lines;
+    invalidateLineCache();
+  }
+
+  void queueLine(unsigned short *active)
+  {
+#if COMPOSITE_STATISTICS
+    int y = lineProgram[programLine];
+    unsigned int t = ESP.getCycleCount();
+#endif
+    const unsigned short *base = renderLine(active);
+#if COMPOSITE_STATISTICS
+    unsigned int cycles = ESP.getCycleCount() - t;
+    //in interrupt mode the whole interrupt is accounted for
+    if(backend != DMA_INTERRUPT)
+      outputCycles += cycles;
+    int bin = cycles * 8 / lineCycles;
+    lineHistogram[y < 0 ? -1 - y : LINE_TEMPLATE_COUNT][bin < statisticsBins ? bin : statisticsBins - 1]++;
+    if(backend == I2S_DRIVER)
+    {
+      t = ESP.getCycleCount();
+      sendLine(base, active);
+      blockedCycles += ESP.getCycleCount() - t;
+      return;
+    }
+#endif
+    sendLine(base, active);
   }
-};
 
+  void resetStatistics()
+  {
+    lateLines = 0;
+    scanlineMisses = 0;
+    prefetchMisses = 0;
+    spriteOverflows = 0;
+#if COMPOSITE_STATISTICS
+    for(int i = 0; i <= LINE_TEMPLATE_COUNT; i++)
+      for(int j = 0; j < statisticsBins; j++)
+        lineHistogram[i][j] = 0;
+    blockedCycles = 0;
+    blockedLoad = 0;
+    spritesLineMax = 0;
+    spritePixelsLineMax = 0;
+#endif
+  }
 
+  //prints the line histograms and counters with the graphics' font at its cursor
+  template<class Graphics>
+  void printStatistics(Graphics &g)
+  {
+#if COMPOSITE_STATISTICS
+    g.print("output ");
+    g.print(outputLoad);
+    g.print("% blocked ");
+    g.print(blockedLoad);
+    g.print("% ");
+#endif
+    g.print("jobs ");
+    g.print(jobLoad);
+    g.print("% late ");
+    //the driver doesn't tell when its DMA ran out of lines, only the ring backends can count them
+    if(backend == I2S_DRIVER)
+      g.print("n/a");
+    else
+      g.print(lateLines);
+    g.print(" missed ");
+    g.print(scanlineMisses);
+    if(prefetchLines)
+    {
+      g.print(" not prefetched ");
+      g.print(prefetchMisses);
+    }
+    if(lineCacheLines)
+    {
+      g.print(" cached ");
+      g.print(lineCacheHitsFrame);
+    }
+    g.print("\n");
+#if COMPOSITE_STATISTICS
+    const char *names[] = {"blank", "LL   ", "LS   ", "SS   ", "SL   ", "S_   ", "_S   ", "pic  "};
+    g.print("line time in 1/8 lines, last >= 1 line\n");
+    for(int i = 0; i <= LINE_TEMPLATE_COUNT; i++)
+    {
+      g.print(names[i]);
+      for(int j = 0; j < statisticsBins; j++)
+      {
+        g.print(" ");
+        g.print(lineHistogram[i][j], 10, 4);
+      }
+      g.print("\n");
+    }
+#endif
+  }
+
+  //sets the frame the interrupt keeps sending. use sendFrame... with the other backends
+  //half resolution frames are targetXres / 2 x targetYres / 2 and both fields show the same rows.
+  //in the progressive modes every field shows all targetYres rows, full and half resolution only differ horizontally
+  void setFrameHalfResolution(char ***frame, PixelFormat format = PIXELS_GRAY8)
+  {
+    if(this->frame != frame || fullResolution || frameFormat != format)
+      invalidateLineCache();
+    if(format == PIXELS_MONO && monoWordsResolution != 0)
+      initMonoWords(false);
+    scanlineRenderer = 0;
+    tileMap = 0;
+    this->frame = frame;
+    fullResolution = false;
+    frameFormat = format;
+  }
+
+  //full resolution frames are targetXres x targetYres, the even field shows the even rows and the odd field the odd rows
+  void setFrameFullResolution(char ***frame, PixelFormat format = PIXELS_GRAY8)
+  {
+    if(this->frame != frame || !fullResolution || frameFormat != format)
+      invalidateLineCache();
+    if(format == PIXELS_MONO && monoWordsResolution != 1)
+      initMonoWords(true);
+    scanlineRenderer = 0;
+    tileMap = 0;
+    this->frame = frame;
+    fullResolution = true;
+    frameFormat = format;
+  }
+
+  //no frame buffer at all, each row is rendered by the callback right before it's encoded.
+  //with DMA_INTERRUPT the callback runs inside the interrupt handler: it must not use floating point (the FPU
+  //isn't available there) or block, and rendering plus encoding the row has to fit into the time of a line
+  void setScanlineRenderer(ScanlineRenderer renderer, bool fullResolution = false)
+  {
+    frame = 0;
+    tileMap = 0;
+    this->fullResolution = fullResolution;
+    frameFormat = PIXELS_GRAY8;
+    scanlineRenderer = renderer;
+  }
+
+  //shows the cells of the map, tile pixels are sent 1:1 in full resolution or doubled in half resolution
+  void setTileMap(TileMap &map, bool fullResolution = false)
+  {
+    frame = 0;
+    scanlineRenderer = 0;
+    this->fullResolution = fullResolution;
+    frameFormat = PIXELS_GRAY8;
+    tileMap = &map;
+  }
+
+  //sprites are taken from the array as they are, changes to their position show up with the next line.
+  //changes of the priority are picked up at the start of the next frame
+  void setSprites(Sprite *sprites, int count)
+  {
+    spriteCount = 0;
+    this->sprites = sprites;
+    if(count > maxSprites)
+      count = maxSprites;
+    sortSprites(count);
+    spriteCount = count;
+  }
+
+  //all picture lines of the field are encoded, the frame can be exchanged now without tearing
+  void vblank()
+  {
+    fieldCount++;
+    if(copper)
+      copper->latch();
+    if(scrollPending)
+    {
+      scrollX = nextScrollX;
+      scrollY = nextScrollY;
+      scrollPending = false;
+    }
+    if(swapPending && (int)(fieldCount - swapField) >= swapInterval)
+    {
+      char **b = *swapFront;
+      *swapFront = *swapBack;
+      *swapBack = b;
+      swapField = fieldCount;
+      swapPending = false;
+    }
+    if(vblankCallback)
+      vblankCallback(vblankArg);
+    TaskHandle_t task = vsyncTask;
+    if(task)
+    {
+      vsyncTask = 0;
+      if(backend == DMA_INTERRUPT)
+      {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(task, &woken);
+        if(woken)
+          portYIELD_FROM_ISR();
+      }
+      else
+        xTaskNotifyGive(task);
+    }
+  }
+
+  //the callback runs at every vertical blank. with DMA_INTERRUPT it's called from the interrupt handler: it must not use
+  //floating point (the FPU isn't available there) or block, and it has to return within the time of a line
+  void setVBlankCallback(VBlankCallback callback, void *arg = 0)
+  {
+    vblankCallback = 0;
+    vblankArg = arg;
+    vblankCallback = callback;
+  }
+
+  //blocks until the next vertical blank. the frames have to be sent by another task or the interrupt
+  void waitForVSync()
+  {
+    unsigned int field = fieldCount;
+    while(fieldCount == field)
+    {
+      vsyncTask = xTaskGetCurrentTaskHandle();
+      //the blank might have passed before the task was registered
+      if(fieldCount != field)
+        break;
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+  }
+
+  //minimum number of fields a swapped frame is shown. 1 gives 50/60fps, 2 gives 25/30fps
+  void setSwapInterval(int fields)
+  {
+    swapInterval = fields;
+  }
+
+  //exchanges the buffers at the next vertical blank that is at least swapInterval fields after the last swap.
+  //front is the one that is shown, e.g. swapBuffers(graphics.frame, graphics.backbuffer).
+  //without wait it returns right away and the back buffer must not be touched until swapPending is cleared.
+  //returns if the swap already happened
+  bool swapBuffers(char **&front, char **&back, bool wait = true)
+  {
+    //a swap still pending has to be done before the buffers can be queued again
+    waitForSwap();
+    swapFront = &front;
+    swapBack = &back;
+    swapPending = true;
+    if(wait)
+      waitForSwap();
+    return !swapPending;
+  }
+
+  void waitForSwap()
+  {
+    while(swapPending)
+      waitForVSync();
+  }
+
+  //adds a job that runs in the blank lines with the given budget in cpu cycles per call. returns its id or -1.
+  //jobs only run with the backends where a task sends the frames
+  int addJob(BlankJob function, void *arg, unsigned int budgetCycles)
+  {
+    for(int i = 0; i < maxJobs; i++)
+      if(!jobs[i].function)
+      {
+        jobs[i].arg = arg;
+        jobs[i].budget = budgetCycles;
+        jobs[i].maxCycles = 0;
+        jobs[i].runs = jobs[i].overruns = 0;
+        jobs[i].function = function;
+        return i;
+      }
+    return -1;
+  }
+
+  void removeJob(int id)
+  {
+    if((unsigned int)id < maxJobs)
+      jobs[id].function = 0;
+  }
+
+  //cycles left of the budget of the running job, for jobs that work in a loop
+  int jobCyclesLeft()
+  {
+    return (int)(jobEndCycles - ESP.getCycleCount());
+  }
+
+  //cycles that can be spent before the output needs the next line. the driver only buffers a single line ahead
+  //so that has to be a blank one too, the ring keeps a margin of two lines
+  unsigned int jobWindow()
+  {
+    if(backend == I2S_DRIVER)
+      return lineProgram[programLine] < 0 ? lineCycles * 3 / 4 : 0;
+    int ahead = (int)(dmaLinesQueued - dmaLinesDone) - 2;
+    return ahead > 0 ? ahead * lineCycles * 3 / 4 : 0;
+  }
+
+  void runJobs(unsigned int window)
+  {
+    unsigned int start = ESP.getCycleCount();
+    for(int n = 0; n < maxJobs; n++)
+    {
+      Job &job = jobs[nextJob];
+      nextJob = (nextJob + 1) % maxJobs;
+      unsigned int need = job.budget > job.maxCycles ? job.budget : job.maxCycles;
+      unsigned int t = ESP.getCycleCount();
+      if(!job.function || t - start + need > window)
+        continue;
+      jobEndCycles = t + job.budget;
+      job.function(job.arg);
+      t = ESP.getCycleCount() - t;
+      job.runs++;
+      if(t > job.budget)
+      {
+        job.overruns++;
+        if(t > job.maxCycles)
+          job.maxCycles = t;
+      }
+    }
+    jobCycles += ESP.getCycleCount() - start;
+  }
+
+  void sendFrame()
+  {
+    for(int l = 0; l < frameLines; l++)
+    {
+      bool blank = lineProgram[programLine] < 0;
+      queueLine(acquireLine());
+      if(blank && backend != DMA_INTERRUPT)
+      {
+        unsigned int window = jobWindow();
+        if(window)
+          runJobs(window);
+      }
+    }
+  }
+
+  void sendFrameHalfResolution(char ***frame, PixelFormat format = PIXELS_GRAY8)
+  {
+    setFrameHalfResolution(frame, format);
+    sendFrame();
+  }
+
+  void sendFrameFullResolution(char ***frame, PixelFormat format = PIXELS_GRAY8)
+  {
+    setFrameFullResolution(frame, format);
+    sendFrame();
+  }
+
+  void sendFrameScanlines(ScanlineRenderer renderer, bool fullResolution = false)
+  {
+    setScanlineRenderer(renderer, fullResolution);
+    sendFrame();
+  }
+
+  void sendFrameTiles(TileMap &map, bool fullResolution = false)
+  {
+    setTileMap(map, fullResolution);
+    sendFrame();
+  }
+};
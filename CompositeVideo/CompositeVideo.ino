@@ -22,6 +22,8 @@
 
 //PAL MAX, half: 324x268 full: 648x536
 //NTSC MAX, half: 324x224 full: 648x448
+//PAL_PROGRESSIVE MAX, half: 324x268 full: 648x268
+//NTSC_PROGRESSIVE MAX, half: 324x224 full: 648x224
 const int XRES = 320;
 const int YRES = 200;
 
@@ -61,8 +63,9 @@ void setup()
   //select font
   graphics.setFont(font);
 
-  //running composite output pinned to first core
-  xTaskCreatePinnedToCore(compositeCore, "compositeCoreTask", 1024, NULL, 1, NULL, 0);
+  //running composite output pinned to first core. the task runs the line program, the blank line jobs,
+  //the vblank callback and scanline renderers on this stack (in bytes), give it more if those need it
+  xTaskCreatePinnedToCore(compositeCore, "compositeCoreTask", 4096, NULL, 1, NULL, 0);
   //rendering the actual graphics in the main loop is done on second core by default
 }
 
@@ -132,8 +135,13 @@ void draw()
   int t = millis();
   int fps = 1000 / (t - lastMillis);
   lastMillis = t;
+  //microseconds the phases of the last frame took
+  static int clearMicros = 0, drawMicros = 0, waitMicros = 0;
+  int mhz = ESP.getCpuFreqMHz();
 
+  unsigned int t0 = ESP.getCycleCount();
   graphics.begin(54);
+  unsigned int t1 = ESP.getCycleCount();
   #if defined(LOGO)
     drawLogo();
   #elif defined(VENUS)
@@ -151,7 +159,21 @@ void draw()
   graphics.print(fps, 10, 2);
   graphics.print(" triangles/s: ");
   graphics.print(fps * model.triangleCount);
-  graphics.end();
+  graphics.setCursor(30, 15);
+  graphics.print("clear: ");
+  graphics.print(clearMicros);
+  graphics.print("us draw: ");
+  graphics.print(drawMicros);
+  graphics.print("us wait: ");
+  graphics.print(waitMicros);
+  graphics.print("us");
+  unsigned int t2 = ESP.getCycleCount();
+  //show the frame at the next vertical blank
+  composite.swapBuffers(graphics.frame, graphics.backbuffer);
+  unsigned int t3 = ESP.getCycleCount();
+  clearMicros = (t1 - t0) / mhz;
+  drawMicros = (t2 - t1) / mhz;
+  waitMicros = (t3 - t2) / mhz;
 }
 
 void loop()
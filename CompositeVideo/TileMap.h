@@ -0,0 +1,127 @@
+#pragma once
+#include "Font.h"
+
+//screen made of character cells that is expanded line by line by CompositeOutput.
+//the tiles use the Font layout: tileXres x tileYres each, stored vertically, starting at ASCII 32
+class TileMap
+{
+  public:
+  int columns;
+  int rows;
+  int tileXres;
+  int tileYres;
+  const unsigned char *tiles;
+  char *cells;
+  int cursorX, cursorY;
+  //tile pixels that are not 0 get the front color, 0 the back color. a front color of -1 shows the tile pixels as they are,
+  //a back color of -1 shows black since there is nothing behind the map. colors above white are shown white
+  int frontColor, backColor;
+
+  TileMap(int columns_, int rows_, int tileXres_, int tileYres_, const unsigned char *tiles_)
+    :columns(columns_),
+    rows(rows_),
+    tileXres(tileXres_),
+    tileYres(tileYres_),
+    tiles(tiles_)
+  {
+    cells = 0;
+    cursorX = cursorY = 0;
+    frontColor = 50;
+    backColor = 0;
+  }
+
+  template<class Graphics>
+  TileMap(int columns_, int rows_, Font<Graphics> &font)
+    :columns(columns_),
+    rows(rows_),
+    tileXres(font.xres),
+    tileYres(font.yres),
+    tiles(font.pixels)
+  {
+    cells = 0;
+    cursorX = cursorY = 0;
+    frontColor = 50;
+    backColor = 0;
+  }
+
+  void init()
+  {
+    cells = (char*)malloc(columns * rows);
+    clear();
+  }
+
+  void setTextColor(int front, int back = 0)
+  {
+    frontColor = front;
+    backColor = back;
+  }
+
+  void clear(char ch = ' ')
+  {
+    memset(cells, ch, columns * rows);
+    cursorX = cursorY = 0;
+  }
+
+  void setCell(int x, int y, char ch)
+  {
+    if((unsigned int)x < (unsigned int)columns && (unsigned int)y < (unsigned int)rows)
+      cells[y * columns + x] = ch;
+  }
+
+  void setCursor(int x, int y)
+  {
+    cursorX = x;
+    cursorY = y;
+  }
+
+  void print(const char *str)
+  {
+    while(*str)
+    {
+      if(*str == '\n')
+      {
+        cursorX = 0;
+        cursorY++;
+      }
+      else
+      {
+        setCell(cursorX++, cursorY, *str);
+        if(cursorX >= columns)
+        {
+          cursorX = 0;
+          cursorY++;
+        }
+      }
+      str++;
+    }
+  }
+
+  void print(int number, int base = 10, int minCharacters = 1)
+  {
+    bool sign = number < 0;
+    if(sign) number = -number;
+    const char baseChars[] = "0123456789ABCDEF";
+    char temp[33];
+    temp[32] = 0;
+    int i = 31;
+    do
+    {
+      temp[i--] = baseChars[number % base];
+      number /= base;
+    }while(number > 0);
+    if(sign)
+      temp[i--] = '-';
+    for(;i > 31 - minCharacters; i--)
+      temp[i] = ' ';
+    print(&temp[i + 1]);
+  }
+
+  //pixels of one row of the tile showing the cell
+  inline const unsigned char *tileRow(char ch, int py)
+  {
+    //char can be signed or unsigned, only the tiles of 32 to 127 exist
+    unsigned char c = ch;
+    if(c < 32 || c >= 128) c = ' ';
+    return &tiles[tileXres * (tileYres * (c - 32) + py)];
+  }
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+//ring of 8 bit unsigned audio samples between one writing task and the video output reading them.
+//it doesn't need a lock as long as there is only one writer
+class AudioBuffer
+{
+  public:
+  int sampleRate;
+  //has to be a power of two
+  int size;
+  unsigned char *samples;
+  volatile unsigned int readPosition;
+  volatile unsigned int writePosition;
+  //samples the output needed while the buffer was empty, the last sample is held then
+  int underruns;
+
+  AudioBuffer(int sampleRate_ = 22050, int size_ = 2048)
+    :sampleRate(sampleRate_),
+    size(size_)
+  {
+    samples = 0;
+    readPosition = writePosition = 0;
+    underruns = 0;
+  }
+
+  void init()
+  {
+    samples = (unsigned char*)malloc(size);
+    memset(samples, 128, size);
+  }
+
+  //samples that can be written without overwriting unread ones
+  int available()
+  {
+    return size - (int)(writePosition - readPosition);
+  }
+
+  bool write(unsigned char sample)
+  {
+    if(!available())
+      return false;
+    samples[writePosition & (size - 1)] = sample;
+    writePosition++;
+    return true;
+  }
+
+  int write(const unsigned char *data, int count)
+  {
+    int n = available();
+    if(count > n)
+      count = n;
+    for(int i = 0; i < count; i++)
+      samples[(writePosition + i) & (size - 1)] = data[i];
+    writePosition += count;
+    return count;
+  }
+
+  //next sample or -1 if there is none
+  inline int read()
+  {
+    if(readPosition == writePosition)
+    {
+      underruns++;
+      return -1;
+    }
+    int sample = samples[readPosition & (size - 1)];
+    readPosition++;
+    return sample;
+  }
+};
+
+//mixes signed 8 bit sounds into an AudioBuffer. play() and mix() have to be called from the same task
+class AudioMixer
+{
+  public:
+  static const int maxVoices = 8;
+  struct Voice
+  {
+    const signed char *samples;
+    int length;
+    int position;
+    //256 is full volume
+    int volume;
+    bool loop;
+  };
+  Voice voices[maxVoices];
+
+  AudioMixer()
+  {
+    for(int i = 0; i < maxVoices; i++)
+      voices[i].samples = 0;
+  }
+
+  //returns the voice playing the sound or -1 if all are busy
+  int play(const signed char *samples, int length, int volume = 256, bool loop = false)
+  {
+    for(int i = 0; i < maxVoices; i++)
+      if(!voices[i].samples)
+      {
+        voices[i].length = length;
+        voices[i].position = 0;
+        voices[i].volume = volume;
+        voices[i].loop = loop;
+        voices[i].samples = samples;
+        return i;
+      }
+    return -1;
+  }
+
+  void stop(int voice)
+  {
+    if((unsigned int)voice < maxVoices)
+      voices[voice].samples = 0;
+  }
+
+  //fills the free part of the buffer
+  void mix(AudioBuffer &buffer)
+  {
+    int count = buffer.available();
+    for(int i = 0; i < count; i++)
+    {
+      int sum = 0;
+      for(int j = 0; j < maxVoices; j++)
+      {
+        Voice &v = voices[j];
+        if(!v.samples)
+          continue;
+        sum += v.samples[v.position] * v.volume >> 8;
+        if(++v.position == v.length)
+        {
+          if(v.loop)
+            v.position = 0;
+          else
+            v.samples = 0;
+        }
+      }
+      if(sum < -128) sum = -128;
+      if(sum > 127) sum = 127;
+      buffer.write(sum + 128);
+    }
+  }
+};
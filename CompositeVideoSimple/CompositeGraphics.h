@@ -1,6 +1,7 @@
 #pragma once
 #include "Font.h"
 #include "TriangleTree.h"
+#include "PixelFormat.h"
 
 class CompositeGraphics
 { 
@@ -9,6 +10,31 @@ class CompositeGraphics
   int yres;
   char **frame;
   char **backbuffer;
+  //third buffer for triple buffering, the newest finished frame. the lowest bit is set until the output picked it up
+  volatile uintptr_t readyBuffer;
+  bool tripleBuffering;
+  //every buffer keeps the number of the frame each row was last drawn in, or clearedVersion. rows with the same version have the same content
+  unsigned int frameNumber;
+  unsigned int *backVersions;
+  //every buffer also keeps for each row the version it had before it got its current one and the pixels x0 to x1 - 1
+  //that were drawn to since then. a row only differs from a row with that base version in this span
+  struct Damage
+  {
+    unsigned int base;
+    short x0, x1;
+  };
+  Damage *backDamage;
+  PixelFormat pixelFormat;
+  //with PIXELS_SAMPLES: the sample words of the output for each gray level and if a pixel is a single sample
+  const unsigned int *sampleWords;
+  bool fullResolutionSamples;
+  int rowBytes;
+  //distance of the rows in the block of a buffer, rowBytes rounded up to whole words
+  int stride;
+  //PIXELS_MONO: gray values from this one on set the pixel
+  char monoThreshold;
+  //rows are allocated in PSRAM, the output should prefetch them then (CompositeOutput::setPrefetch)
+  bool externalMemory;
   char **zbuffer;
   int cursorX, cursorY, cursorBaseX;
   int frontColor, backColor;
@@ -29,6 +55,43 @@ class CompositeGraphics
     triangleCount = 0;
     frontColor = 50;
     backColor = -1;
+    readyBuffer = 0;
+    tripleBuffering = false;
+    frameNumber = 0;
+    backVersions = 0;
+    backDamage = 0;
+    pixelFormat = PIXELS_GRAY8;
+    sampleWords = 0;
+    fullResolutionSamples = false;
+    rowBytes = xres;
+    stride = (rowBytes + 3) & ~3;
+    monoThreshold = 28;
+    externalMemory = false;
+  }
+
+  //has to be set before init(). for PIXELS_SAMPLES the output's pixelWords are needed and
+  //if the frame is sent in full resolution
+  void setPixelFormat(PixelFormat format, const unsigned int *pixelWords = 0, bool fullResolution = false)
+  {
+    pixelFormat = format;
+    sampleWords = pixelWords;
+    fullResolutionSamples = fullResolution;
+    if(format == PIXELS_SAMPLES)
+      rowBytes = xres * (fullResolution ? 2 : 4);
+    else if(format == PIXELS_GRAY4)
+      rowBytes = (xres + 1) / 2;
+    else if(format == PIXELS_MONO)
+      rowBytes = (xres + 7) / 8;
+    else
+      rowBytes = xres;
+    stride = (rowBytes + 3) & ~3;
+  }
+
+  //has to be set before init(). puts the rows of the buffers into external RAM, the row tables stay internal.
+  //the DMA can't read PSRAM, the output copies the rows of sample frames there instead of sending them zero-copy
+  void setExternalMemory(bool external)
+  {
+    externalMemory = external;
   }
 
   void setTextColor(int front, int back = -1)
@@ -38,18 +101,156 @@ class CompositeGraphics
     backColor = back;
   }
   
-  void init()
+  //row table of a cleared buffer. the row versions and damage are kept in front of the table so they stay with it on every swap.
+  //the rows are a single word aligned block, stride bytes apart, the table is only a view of it.
+  //if there is no free block that large the rows are allocated one by one
+  char **allocateBuffer()
   {
-    frame = (char**)malloc(yres * sizeof(char*));
-    backbuffer = (char**)malloc(yres * sizeof(char*));
-    //not enough memory for z-buffer implementation
-    //zbuffer = (char**)malloc(yres * sizeof(char*));
+    char **rows = (char**)malloc((yres + 2) * sizeof(char*)) + 2;
+    rows[-1] = (char*)malloc(yres * sizeof(unsigned int));
+    rows[-2] = (char*)malloc(yres * sizeof(Damage));
+    //sample rows are sent by DMA straight from the buffer, unless they are in PSRAM. then the output copies them
+    int caps = MALLOC_CAP_8BIT;
+    if(externalMemory)
+      caps = MALLOC_CAP_SPIRAM;
+    else if(pixelFormat == PIXELS_SAMPLES)
+      caps = MALLOC_CAP_DMA;
+    char *block = (char*)heap_caps_malloc(stride * yres, caps);
     for(int y = 0; y < yres; y++)
     {
-      frame[y] = (char*)malloc(xres);
-      backbuffer[y] = (char*)malloc(xres);
-      //zbuffer[y] = (char*)malloc(xres);
+      rows[y] = block ? block + y * stride : (char*)heap_caps_malloc(stride, caps);
+      //a word of black samples is the same in both resolutions
+      if(pixelFormat == PIXELS_SAMPLES)
+        for(int i = 0; i < stride / 4; i++)
+          ((unsigned int*)rows[y])[i] = sampleWords[0];
+      else
+        memset(rows[y], 0, stride);
+      ((unsigned int*)rows[-1])[y] = clearedVersion(0);
+      ((Damage*)rows[-2])[y].base = clearedVersion(0);
+      ((Damage*)rows[-2])[y].x0 = ((Damage*)rows[-2])[y].x1 = 0;
+    }
+    return rows;
+  }
+
+  //if row y1 follows row y0 in memory, true for all rows of a buffer allocated as one block
+  inline bool contiguous(char **rows, int y0, int y1)
+  {
+    return rows[y1] == rows[y0] + (y1 - y0) * stride;
+  }
+
+  //version of rows that are cleared to a color, frame numbers never get that high.
+  //begin() only has to clear rows that don't have this version already
+  static inline unsigned int clearedVersion(char color)
+  {
+    return 0x80000000u | (unsigned char)color;
+  }
+
+  //if the version is a frame number, only those rows have a damage span
+  static inline bool drawnVersion(unsigned int version)
+  {
+    return version < clearedVersion(0);
+  }
+
+  //a word of pixels of the color in the buffer format
+  inline unsigned int fillWord(char color)
+  {
+    if(pixelFormat == PIXELS_GRAY4)
+      return grayNibble(color) * 0x11111111u;
+    if(pixelFormat == PIXELS_MONO)
+      return monoBit(color) ? ~0u : 0;
+    if(pixelFormat == PIXELS_SAMPLES)
+      return sampleWords[(unsigned char)color];
+    return (unsigned char)color * 0x01010101u;
+  }
+
+  //fills the rows y0 to y1 - 1 of the back buffer with the word, rows that follow each other in memory at once
+  void fillRows(int y0, int y1, unsigned int word)
+  {
+    while(y0 < y1)
+    {
+      int y = y0 + 1;
+      while(y < y1 && contiguous(backbuffer, y0, y))
+        y++;
+      fillWords((unsigned int*)backbuffer[y0], (y - y0) * stride / 4, word);
+      y0 = y;
+    }
+  }
+
+  static inline void fillWords(unsigned int *words, int count, unsigned int word)
+  {
+    if(word == (word & 255) * 0x01010101u)
+      memset(words, word & 255, count * 4);
+    else
+      for(int i = 0; i < count; i++)
+        words[i] = word;
+  }
+
+  //the words of a row that hold the pixels x0 to x1 - 1
+  inline void spanWords(int x0, int x1, int &w0, int &w1)
+  {
+    int b0 = x0, b1 = x1;
+    if(pixelFormat == PIXELS_GRAY4)
+    {
+      b0 = x0 >> 1;
+      b1 = (x1 + 1) >> 1;
+    }
+    else if(pixelFormat == PIXELS_MONO)
+    {
+      b0 = x0 >> 3;
+      b1 = (x1 + 7) >> 3;
+    }
+    else if(pixelFormat == PIXELS_SAMPLES)
+    {
+      b0 = x0 * (fullResolutionSamples ? 2 : 4);
+      b1 = x1 * (fullResolutionSamples ? 2 : 4);
     }
+    w0 = b0 >> 2;
+    w1 = (b1 + 3) >> 2;
+  }
+
+  static const unsigned int *rowVersions(char **rows)
+  {
+    return (const unsigned int*)rows[-1];
+  }
+
+  static Damage *rowDamage(char **rows)
+  {
+    return (Damage*)rows[-2];
+  }
+
+  //marks the pixels x0 to x1 - 1 of the back buffer row as drawn to in this frame
+  inline void damage(int y, int x0, int x1)
+  {
+    Damage &d = backDamage[y];
+    if(backVersions[y] != frameNumber)
+    {
+      d.base = backVersions[y];
+      d.x0 = x0;
+      d.x1 = x1;
+      backVersions[y] = frameNumber;
+      return;
+    }
+    if(x0 < d.x0)
+      d.x0 = x0;
+    if(x1 > d.x1)
+      d.x1 = x1;
+  }
+
+  //with triple buffering end() never has to wait for the output. it costs a third frame buffer
+  void init(bool tripleBuffering = false)
+  {
+    this->tripleBuffering = tripleBuffering;
+    frame = allocateBuffer();
+    backbuffer = allocateBuffer();
+    //drawing can start before the first begin()
+    backVersions = (unsigned int*)backbuffer[-1];
+    backDamage = rowDamage(backbuffer);
+    //not enough memory for z-buffer implementation
+    //zbuffer = (char**)malloc(yres * sizeof(char*));
+    //for(int y = 0; y < yres; y++)
+    //  zbuffer[y] = (char*)malloc(xres);
+    if(tripleBuffering)
+      readyBuffer = (uintptr_t)allocateBuffer();
     triangleBuffer = (TriangleTree<CompositeGraphics>*)malloc(sizeof(TriangleTree<CompositeGraphics>) * trinagleBufferSize);
   }
 
@@ -64,7 +265,7 @@ class CompositeGraphics
     cursorY = y;  
   }
   
-  void print(char *str)
+  void print(const char *str)
   {
     if(!font) return;
     while(*str)
@@ -101,38 +302,164 @@ class CompositeGraphics
     print(&temp[i + 1]);
   }
 
+  //without clear the drawing continues on the last frame. with double buffering the rows
+  //that changed in it are copied over first, so the two buffers stay the same apart from the new drawing.
+  //clearing only touches the rows that were drawn to since the buffer was cleared to the same color.
+  //rows that only got drawn to since they had the version wanted only get their damage span cleared or copied.
+  //the copy can't be done in end(), the buffer it goes to is still shown until the swap
   inline void begin(int clear = -1, bool clearZ = true)
   {
+    frameNumber++;
+    backVersions = (unsigned int*)backbuffer[-1];
+    backDamage = rowDamage(backbuffer);
     if(clear > -1)
-      for(int y = 0; y < yres; y++)
-        for(int x = 0; x < xres; x++)
-          backbuffer[y][x] = clear;
+    {
+      unsigned int cleared = clearedVersion(clear);
+      unsigned int word = fillWord(clear);
+      for(int y = 0; y < yres;)
+      {
+        if(backVersions[y] == cleared)
+        {
+          y++;
+          continue;
+        }
+        if(drawnVersion(backVersions[y]) && backDamage[y].base == cleared)
+        {
+          int w0, w1;
+          spanWords(backDamage[y].x0, backDamage[y].x1, w0, w1);
+          fillWords((unsigned int*)backbuffer[y] + w0, w1 - w0, word);
+          backVersions[y++] = cleared;
+          continue;
+        }
+        int y1 = y + 1;
+        while(y1 < yres && backVersions[y1] != cleared && !(drawnVersion(backVersions[y1]) && backDamage[y1].base == cleared))
+          y1++;
+        fillRows(y, y1, word);
+        for(; y < y1; y++)
+          backVersions[y] = cleared;
+      }
+    }
+    else if(!tripleBuffering)
+    {
+      const unsigned int *frontVersions = rowVersions(frame);
+      const Damage *frontDamage = rowDamage(frame);
+      for(int y = 0; y < yres;)
+      {
+        if(backVersions[y] == frontVersions[y])
+        {
+          y++;
+          continue;
+        }
+        if(drawnVersion(frontVersions[y]) && frontDamage[y].base == backVersions[y])
+        {
+          int w0, w1;
+          spanWords(frontDamage[y].x0, frontDamage[y].x1, w0, w1);
+          memcpy((unsigned int*)backbuffer[y] + w0, (unsigned int*)frame[y] + w0, (w1 - w0) * 4);
+          backDamage[y] = frontDamage[y];
+          backVersions[y] = frontVersions[y];
+          y++;
+          continue;
+        }
+        //changed rows that follow each other in both blocks are copied at once
+        int y1 = y + 1;
+        while(y1 < yres && backVersions[y1] != frontVersions[y1] && !(drawnVersion(frontVersions[y1]) && frontDamage[y1].base == backVersions[y1]) &&
+          contiguous(backbuffer, y, y1) && contiguous(frame, y, y1))
+          y1++;
+        memcpy(backbuffer[y], frame[y], (y1 - y - 1) * stride + rowBytes);
+        for(; y < y1; y++)
+        {
+          backDamage[y] = frontDamage[y];
+          backVersions[y] = frontVersions[y];
+        }
+      }
+    }
     triangleCount = 0;
     triangleRoot = 0;
   }
 
+  //doesn't clear the frame: it continues on the last one like begin() and only the rectangle is cleared.
+  //everything outside of it keeps what was drawn before
+  inline void begin(int clear, int x, int y, int w, int h)
+  {
+    begin();
+    fillRect(x, y, w, h, clear);
+  }
+
+  //gray value to the 4 bit pixel of PIXELS_GRAY4
+  static inline int grayNibble(char color)
+  {
+    int n = (unsigned char)color >> 2;
+    return n > 15 ? 15 : n;
+  }
+
+  inline bool monoBit(char color)
+  {
+    return (unsigned char)color >= (unsigned char)monoThreshold;
+  }
+
   inline void dotFast(int x, int y, char color)
   {
-    backbuffer[y][x] = color;
+    pixel(x, y, color);
+    damage(y, x, x + 1);
+  }
+
+  //writes a pixel without marking it as drawn, for primitives that mark all of theirs at once
+  inline void pixel(int x, int y, char color)
+  {
+    if(pixelFormat == PIXELS_GRAY8)
+      backbuffer[y][x] = color;
+    else if(pixelFormat == PIXELS_GRAY4)
+    {
+      char &pair = backbuffer[y][x >> 1];
+      if(x & 1)
+        pair = (pair & 0x0f) | (grayNibble(color) << 4);
+      else
+        pair = (pair & 0xf0) | grayNibble(color);
+    }
+    else if(pixelFormat == PIXELS_MONO)
+    {
+      if(monoBit(color))
+        backbuffer[y][x >> 3] |= 1 << (x & 7);
+      else
+        backbuffer[y][x >> 3] &= ~(1 << (x & 7));
+    }
+    else if(fullResolutionSamples)
+      ((unsigned short*)backbuffer[y])[x ^ 1] = sampleWords[(unsigned char)color];
+    else
+      ((unsigned int*)backbuffer[y])[x] = sampleWords[(unsigned char)color];
   }
   
   inline void dot(int x, int y, char color)
   {
     if((unsigned int)x < xres && (unsigned int)y < yres)
-      backbuffer[y][x] = color;
+      dotFast(x, y, color);
   }
   
   inline void dotAdd(int x, int y, char color)
   {
     if((unsigned int)x < xres && (unsigned int)y < yres)
-      backbuffer[y][x] = min(54, color + backbuffer[y][x]);
+      dotFast(x, y, min(54, color + get(x, y)));
+  }
+
+  //if the row was drawn to since begin()
+  inline bool rowTouched(int y)
+  {
+    return backVersions[y] == frameNumber;
   }
   
   inline char get(int x, int y)
   {
-    if((unsigned int)x < xres && (unsigned int)y < yres)
+    if((unsigned int)x >= xres || (unsigned int)y >= yres)
+      return 0;
+    if(pixelFormat == PIXELS_GRAY8)
       return backbuffer[y][x];
-    return 0;
+    if(pixelFormat == PIXELS_GRAY4)
+      return ((backbuffer[y][x >> 1] >> ((x & 1) * 4)) & 15) << 2;
+    if(pixelFormat == PIXELS_MONO)
+      return (backbuffer[y][x >> 3] >> (x & 7)) & 1 ? 54 : 0;
+    //the sample of gray 0 is the black level
+    unsigned short sample = fullResolutionSamples ? ((unsigned short*)backbuffer[y])[x ^ 1] : ((unsigned int*)backbuffer[y])[x];
+    return (sample >> 8) - ((sampleWords[0] >> 8) & 255);
   }
     
   inline void xLine(int x0, int x1, int y, char color)
@@ -145,8 +472,162 @@ class CompositeGraphics
     }
     if(x0 < 0) x0 = 0;
     if(x1 > xres) x1 = xres;
-    for(int x = x0; x < x1; x++)
-      dotFast(x, y, color);
+    if(x0 >= x1) return;
+    damage(y, x0, x1);
+    if(pixelFormat == PIXELS_GRAY8)
+      memset(backbuffer[y] + x0, color, x1 - x0);
+    else if(pixelFormat == PIXELS_GRAY4)
+    {
+      //odd pixels at the ends share their byte, the ones between are filled a byte of two pixels at a time
+      char *row = backbuffer[y];
+      int n = grayNibble(color);
+      if(x0 & 1)
+      {
+        row[x0 >> 1] = (row[x0 >> 1] & 0x0f) | (n << 4);
+        x0++;
+      }
+      if(x1 & 1 && x0 < x1)
+      {
+        row[x1 >> 1] = (row[x1 >> 1] & 0xf0) | n;
+        x1--;
+      }
+      if(x0 < x1)
+        memset(row + (x0 >> 1), n | (n << 4), (x1 - x0) >> 1);
+    }
+    else if(pixelFormat == PIXELS_MONO)
+      maskSpan(backbuffer[y], x0, x1, monoBit(color));
+    else if(fullResolutionSamples)
+    {
+      unsigned short *row = (unsigned short*)backbuffer[y];
+      unsigned short sample = sampleWords[(unsigned char)color];
+      for(int x = x0; x < x1; x++)
+        row[x ^ 1] = sample;
+    }
+    else
+    {
+      unsigned int *row = (unsigned int*)backbuffer[y];
+      unsigned int word = sampleWords[(unsigned char)color];
+      for(int x = x0; x < x1; x++)
+        row[x] = word;
+    }
+  }
+
+  //sets or clears the bits x0 to x1 - 1 of a PIXELS_MONO row, the bytes in between are filled at once
+  static void maskSpan(char *row, int x0, int x1, bool set)
+  {
+    int b0 = x0 >> 3;
+    int b1 = (x1 - 1) >> 3;
+    unsigned char first = 0xff << (x0 & 7);
+    unsigned char last = 0xff >> (7 - ((x1 - 1) & 7));
+    if(b0 == b1)
+      first &= last;
+    if(set)
+      row[b0] |= first;
+    else
+      row[b0] &= ~first;
+    if(b0 == b1)
+      return;
+    if(b1 > b0 + 1)
+      memset(row + b0 + 1, set ? 0xff : 0, b1 - b0 - 1);
+    if(set)
+      row[b1] |= last;
+    else
+      row[b1] &= ~last;
+  }
+
+  //draws count pixels of a bit mask, the first one in the lowest bit. set bits get the front color and
+  //clear ones the back color, or are left as they are for a back color of -1. used for the font glyphs
+  void maskRow(int x, int y, unsigned int bits, int count, int frontColor, int backColor)
+  {
+    if((unsigned int)y >= (unsigned int)yres)
+      return;
+    if(x < 0)
+    {
+      bits = -x < 32 ? bits >> -x : 0;
+      count += x;
+      x = 0;
+    }
+    if(x + count > xres)
+      count = xres - x;
+    if(count <= 0)
+      return;
+    unsigned int all = count < 32 ? (1u << count) - 1 : ~0u;
+    bits &= all;
+    if(pixelFormat != PIXELS_MONO)
+    {
+      if(backColor < 0 && !bits)
+        return;
+      for(int i = 0; i < count; i++)
+        if((bits >> i) & 1)
+          pixel(x + i, y, frontColor);
+        else if(backColor >= 0)
+          pixel(x + i, y, backColor);
+      damage(y, x, x + count);
+      return;
+    }
+    mergeBits(x, y, backColor >= 0 ? all : bits, (monoBit(frontColor) ? bits : 0) | (backColor >= 0 && monoBit(backColor) ? ~bits & all : 0));
+  }
+
+  //PIXELS_MONO: the changed bits of the row from x on get the ones of value, with one read-modify-write per byte
+  inline void mergeBits(int x, int y, unsigned long long changed, unsigned long long value)
+  {
+    if(!changed)
+      return;
+    damage(y, x, x + 64 - __builtin_clzll(changed));
+    changed <<= x & 7;
+    value <<= x & 7;
+    unsigned char *row = (unsigned char*)backbuffer[y] + (x >> 3);
+    for(; changed; changed >>= 8, value >>= 8, row++)
+      *row = (*row & ~changed) | (value & changed);
+  }
+
+  //copies count pixels of gray values to the row, used by the image blitters
+  void blitRow(int x, int y, const unsigned char *pixels, int count)
+  {
+    if((unsigned int)y >= (unsigned int)yres)
+      return;
+    if(x < 0)
+    {
+      pixels -= x;
+      count += x;
+      x = 0;
+    }
+    if(x + count > xres)
+      count = xres - x;
+    if(count <= 0)
+      return;
+    if(pixelFormat == PIXELS_GRAY8)
+      memcpy(backbuffer[y] + x, pixels, count);
+    else if(pixelFormat == PIXELS_GRAY4)
+    {
+      //two pixels are packed into a byte at once once the row position is even
+      char *row = backbuffer[y];
+      int i = 0;
+      if(x & 1)
+      {
+        pixel(x, y, pixels[0]);
+        i = 1;
+      }
+      for(; i + 1 < count; i += 2)
+        row[(x + i) >> 1] = grayNibble(pixels[i]) | (grayNibble(pixels[i + 1]) << 4);
+      if(i < count)
+        pixel(x + i, y, pixels[i]);
+    }
+    else if(pixelFormat == PIXELS_MONO)
+      //up to 32 pixels at a time are turned into a mask
+      for(int i = 0; i < count; i += 32)
+      {
+        int n = count - i < 32 ? count - i : 32;
+        unsigned int bits = 0;
+        for(int j = 0; j < n; j++)
+          if(monoBit(pixels[i + j]))
+            bits |= 1u << j;
+        mergeBits(x + i, y, n < 32 ? (1u << n) - 1 : ~0u, bits);
+      }
+    else
+      for(int i = 0; i < count; i++)
+        pixel(x + i, y, pixels[i]);
+    damage(y, x, x + count);
   }
 
   void enqueueTriangle(short *v0, short *v1, short *v2, char color)
@@ -298,11 +779,29 @@ class CompositeGraphics
 
   inline void end()
   {
+    if(tripleBuffering)
+    {
+      //hand the finished frame over and continue with the one the output didn't pick up or already let go
+      uintptr_t b = __atomic_exchange_n(&readyBuffer, (uintptr_t)backbuffer | 1, __ATOMIC_ACQ_REL);
+      backbuffer = (char**)(b & ~(uintptr_t)1);
+      return;
+    }
     char **b = backbuffer;
     backbuffer = frame;
     frame = b;    
   }
 
+  //called by the output between two fields with triple buffering, e.g. composite.setVBlankCallback(CompositeGraphics::latchFrame, &graphics).
+  //makes the newest finished frame the shown one. only the output ever writes frame
+  static void latchFrame(void *graphics)
+  {
+    CompositeGraphics &g = *(CompositeGraphics*)graphics;
+    if(!(__atomic_load_n(&g.readyBuffer, __ATOMIC_ACQUIRE) & 1))
+      return;
+    uintptr_t b = __atomic_exchange_n(&g.readyBuffer, (uintptr_t)g.frame, __ATOMIC_ACQ_REL);
+    g.frame = (char**)(b & ~(uintptr_t)1);
+  }
+
   void fillRect(int x, int y, int w, int h, int color)
   {
     if(x < 0)
@@ -319,9 +818,18 @@ class CompositeGraphics
       w = xres - x;
     if(y + h > yres)
       h = yres - y;
+    if(w <= 0 || h <= 0)
+      return;
+    //whole rows are filled like a clear and get the version of cleared rows
+    if(w == xres)
+    {
+      fillRows(y, y + h, fillWord(color));
+      for(int j = y; j < y + h; j++)
+        backVersions[j] = clearedVersion(color);
+      return;
+    }
     for(int j = y; j < y + h; j++)
-      for(int i = x; i < x + w; i++)
-        dotFast(i, j, color);
+      xLine(x, x + w, j, color);
   }
 
   void rect(int x, int y, int w, int h, int color)
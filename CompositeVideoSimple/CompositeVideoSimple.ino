@@ -10,6 +10,8 @@
 
 //PAL MAX, half: 324x268 full: 648x536
 //NTSC MAX, half: 324x224 full: 648x448
+//PAL_PROGRESSIVE MAX, half: 324x268 full: 648x268
+//NTSC_PROGRESSIVE MAX, half: 324x224 full: 648x224
 const int XRES = 320;
 const int YRES = 200;
 
@@ -42,8 +44,9 @@ void setup()
   //select font
   graphics.setFont(font);
 
-  //running composite output pinned to first core
-  xTaskCreatePinnedToCore(compositeCore, "compositeCoreTask", 1024, NULL, 1, NULL, 0);
+  //running composite output pinned to first core. the task runs the line program, the blank line jobs,
+  //the vblank callback and scanline renderers on this stack (in bytes), give it more if those need it
+  xTaskCreatePinnedToCore(compositeCore, "compositeCoreTask", 4096, NULL, 1, NULL, 0);
   //rendering the actual graphics in the main loop is done on the second core by default
 }
 
@@ -92,8 +95,8 @@ void draw()
   //draw single pixel
   graphics.dot(20, 190, 10);
   
-  //finished drawing, swap back and front buffer to display it
-  graphics.end();
+  //finished drawing, swap back and front buffer during the next vertical blank to display it without tearing
+  composite.swapBuffers(graphics.frame, graphics.backbuffer);
 }
 
 void loop()
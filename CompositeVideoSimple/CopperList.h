@@ -0,0 +1,100 @@
+#pragma once
+
+//raster effects for single picture lines, applied by CompositeOutput while frame or scanline renderer rows are encoded.
+//there are two lists: the shown one and the one that is edited. commit() makes the edited one the shown one
+//at the next vertical blank, then it's copied back so the editing can continue on it
+class CopperList
+{
+  public:
+  struct Line
+  {
+    //pixel words the line is encoded with instead of the default ones, see CompositeOutput::initPalette
+    const unsigned int *palette;
+    //pixels the line is moved to the left, negative values move it to the right
+    short offset;
+    //frame row shown on this line, -1 shows its own
+    short row;
+  };
+  //one entry for each frame row
+  int rows;
+  Line *lists[2];
+  volatile int shown;
+  volatile bool pending;
+
+  CopperList(int rows_)
+    :rows(rows_)
+  {
+    lists[0] = lists[1] = 0;
+    shown = 0;
+    pending = false;
+  }
+
+  void init()
+  {
+    for(int i = 0; i < 2; i++)
+      lists[i] = (Line*)malloc(sizeof(Line) * rows);
+    clear();
+    memcpy(lists[shown], lists[shown ^ 1], sizeof(Line) * rows);
+  }
+
+  //the list that is edited, it must not be changed while a commit is pending
+  Line *edit()
+  {
+    return lists[shown ^ 1];
+  }
+
+  void clear()
+  {
+    Line *l = edit();
+    for(int i = 0; i < rows; i++)
+    {
+      l[i].palette = 0;
+      l[i].offset = 0;
+      l[i].row = -1;
+    }
+  }
+
+  void setPalette(int row, const unsigned int *palette)
+  {
+    if((unsigned int)row < (unsigned int)rows)
+      edit()[row].palette = palette;
+  }
+
+  void setOffset(int row, int offset)
+  {
+    if((unsigned int)row < (unsigned int)rows)
+      edit()[row].offset = offset;
+  }
+
+  void setRow(int row, int sourceRow)
+  {
+    if((unsigned int)row < (unsigned int)rows)
+      edit()[row].row = sourceRow;
+  }
+
+  void commit()
+  {
+    pending = true;
+  }
+
+  //called by the output at the vertical blank
+  void latch()
+  {
+    if(!pending)
+      return;
+    shown ^= 1;
+    memcpy(lists[shown ^ 1], lists[shown], sizeof(Line) * rows);
+    pending = false;
+  }
+
+  //command of a row of the shown list or 0 if it has none
+  inline const Line *line(int row)
+  {
+    if((unsigned int)row >= (unsigned int)rows)
+      return 0;
+    const Line *l = &lists[shown][row];
+    if(!l->palette && !l->offset && l->row < 0)
+      return 0;
+    return l;
+  }
+};
@@ -18,6 +18,19 @@ class Font
   void drawChar(Graphics &g, int x, int y, char ch, int frontColor, int backColor)
   {
     const unsigned char *pix = &pixels[xres * yres * (ch - 32)];
+    if(xres <= 32)
+    {
+      //each glyph row is drawn as a bit mask
+      for(int py = 0; py < yres; py++)
+      {
+        unsigned int bits = 0;
+        for(int px = 0; px < xres; px++)
+          if(*(pix++))
+            bits |= 1u << px;
+        g.maskRow(x, py + y, bits, xres, frontColor, backColor);
+      }
+      return;
+    }
     for(int py = 0; py < yres; py++)
       for(int px = 0; px < xres; px++)
         if(*(pix++))
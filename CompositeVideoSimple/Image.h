@@ -21,20 +21,14 @@ class Image
 
   void draw(Graphics &g, int x, int y)
   {
-    int i = 0;
     for(int py = 0; py < yres; py++)
-      for(int px = 0; px < xres; px++)
-        g.dot(px + x, py + y, pixels[i++]);
+      g.blitRow(x, py + y, &pixels[py * xres], xres);
   }
 
   void draw(Graphics &g, int x, int y, int srcX, int srcY, int srcXres, int srcYres)
   {
     for(int py = 0; py < srcYres; py++)
-    {
-      int i = srcX + (py + srcY) * xres;
-      for(int px = 0; px < srcXres; px++)
-        g.dot(px + x, py + y, pixels[i++]);
-    }
+      g.blitRow(x, py + y, &pixels[srcX + (py + srcY) * xres], srcXres);
   }
   
   void draw(Graphics &g, int x, int y, int t)
@@ -0,0 +1,18 @@
+#pragma once
+
+//how the rows of a frame are stored. CompositeGraphics draws in it and CompositeOutput sends it
+enum PixelFormat
+{
+  //a byte per pixel, black is 0 and white is grayValues - 1 of the output
+  PIXELS_GRAY8,
+  //pixels already are the DAC samples they are sent as: level shifted and in DMA byte order.
+  //a word (two samples) per pixel in half resolution, one sample per pixel in full resolution.
+  //the rows are sent as they are, they have to be exactly as long as the active part of a line
+  PIXELS_SAMPLES,
+  //two pixels per byte, the even one in the lower nibble. a nibble keeps the upper bits of the gray value (gray / 4),
+  //so the buffers take half the memory of PIXELS_GRAY8 and there are 16 levels
+  PIXELS_GRAY4,
+  //a bit per pixel, the first pixel of a byte in its lowest bit. set bits are sent in the foreground level of the
+  //output and clear ones in the background level, see CompositeOutput::setMonoColors
+  PIXELS_MONO
+};
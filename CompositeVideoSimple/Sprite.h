@@ -0,0 +1,47 @@
+#pragma once
+#include "Image.h"
+
+//image composited over the picture by CompositeOutput while the lines are encoded.
+//moving it doesn't touch the frame buffer. coordinates are the ones of the frame it's shown on
+class Sprite
+{
+  public:
+  int xres;
+  int yres;
+  const unsigned char *pixels;
+  int x, y;
+  //pixels of this value are not drawn, -1 draws all of them
+  int transparent;
+  //sprites with a higher priority are drawn on top and win if there are too many on a line
+  int priority;
+  bool visible;
+
+  Sprite(int xres_, int yres_, const unsigned char *pixels_, int transparent_ = 0, int priority_ = 0)
+    :xres(xres_),
+    yres(yres_),
+    pixels(pixels_),
+    transparent(transparent_),
+    priority(priority_)
+  {
+    x = y = 0;
+    visible = true;
+  }
+
+  template<class Graphics>
+  Sprite(Image<Graphics> &image, int transparent_ = 0, int priority_ = 0)
+    :xres(image.xres),
+    yres(image.yres),
+    pixels(image.pixels),
+    transparent(transparent_),
+    priority(priority_)
+  {
+    x = y = 0;
+    visible = true;
+  }
+
+  void setPosition(int x, int y)
+  {
+    this->x = x;
+    this->y = y;
+  }
+};